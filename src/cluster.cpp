@@ -0,0 +1,407 @@
+#include "cluster.h"
+#include "global.h"
+#include "config.h"
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+
+// Protocol, every message is a Message_header followed by count items, in the byte order of the host.
+// The worker sends MESSAGE_HELLO with one Wire_hello, the coordinator answers with MESSAGE_CHUNK of Wire_point,
+// the worker sends MESSAGE_RECORDS of Wire_record in the order of the chunk until all of it is done, and so on.
+// A chunk of no points ends the worker, a coordinator that rejects the hello just disconnects.
+
+// enum MESSAGE_
+enum Message
+{
+    MESSAGE_HELLO,
+    MESSAGE_CHUNK,
+    MESSAGE_RECORDS
+};
+
+// Chunks handed out ahead of the first one not passed on yet, a worker that asks for more waits for it.
+static constexpr int window_chunks = 256;
+
+struct Message_header
+{
+    uint32_t type;
+    uint32_t count;
+};
+
+// What has to be the same for results of a worker to be comparable with the others.
+// Compared bytewise, padding is zeroed.
+struct Wire_hello
+{
+    uint64_t kernel_plugin_hash;
+    uint64_t scaled_image_hash;
+    uint64_t reference_image_hash;
+    int32_t filter;
+    int32_t kernel;
+    int32_t screen_rank;
+    int32_t src_width;
+    int32_t src_height;
+    int32_t dst_width;
+    int32_t dst_height;
+    float ar;
+    float sparse_eps;
+    int32_t half;
+    int32_t box_reduce;
+    int32_t ssim_box;
+    int32_t fast_math;
+};
+
+struct Wire_point
+{
+    float radius;
+    float blur;
+    float p1;
+    float p2;
+};
+
+struct Wire_record
+{
+    Wire_point point;
+    double result;
+    double error;
+};
+
+struct Socket_address
+{
+    sockaddr_storage storage;
+    int size;
+    int family;
+};
+
+static bool create_address(const std::string& text, Socket_address& address)
+{
+    std::memset(&address.storage, 0, sizeof(address.storage));
+    if (!text.empty() && std::all_of(text.begin(), text.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); })) {
+        auto& in = reinterpret_cast<sockaddr_in&>(address.storage);
+        in.sin_family = AF_INET;
+        in.sin_port = htons(static_cast<uint16_t>(std::stoi(text)));
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.size = sizeof(sockaddr_in);
+        address.family = AF_INET;
+        return true;
+    }
+    auto& un = reinterpret_cast<sockaddr_un&>(address.storage);
+    if (text.empty() || text.size() >= sizeof(un.sun_path)) {
+        return false;
+    }
+    un.sun_family = AF_UNIX;
+    std::memcpy(un.sun_path, text.c_str(), text.size());
+    address.size = sizeof(sockaddr_un);
+    address.family = AF_UNIX;
+    return true;
+}
+
+static Wire_hello create_hello()
+{
+    Wire_hello hello;
+    std::memset(&hello, 0, sizeof(hello));
+    hello.kernel_plugin_hash = g_kernel_plugin_hash;
+    hello.scaled_image_hash = g_scaled_image_hash;
+    hello.reference_image_hash = g_reference_image_hash;
+    hello.filter = config::filter;
+    hello.kernel = config::kernel;
+    hello.screen_rank = config::screen_rank;
+    hello.src_width = g_src_width;
+    hello.src_height = g_src_height;
+    hello.dst_width = g_dst_width;
+    hello.dst_height = g_dst_height;
+    hello.ar = config::ar;
+    hello.sparse_eps = config::sparse_eps;
+    hello.half = config::half;
+    hello.box_reduce = config::box_reduce;
+    hello.ssim_box = config::ssim_box;
+    hello.fast_math = config::fast_math;
+    return hello;
+}
+
+static bool send_all(SOCKET s, const void* data, size_t size)
+{
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        const int n = send(s, p, static_cast<int>(std::min<size_t>(size, 1 << 20)), 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool recv_all(SOCKET s, void* data, size_t size)
+{
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        const int n = recv(s, p, static_cast<int>(std::min<size_t>(size, 1 << 20)), 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+template <typename T>
+static bool send_message(SOCKET s, Message type, const T* items, size_t count)
+{
+    const Message_header header = { static_cast<uint32_t>(type), static_cast<uint32_t>(count) };
+    return send_all(s, &header, sizeof(header)) && send_all(s, items, count * sizeof(T));
+}
+
+bool run_coordinator(const std::string& address, const Sweep_source& source, int chunk, const std::function<void(const Sweep_batch&)>& done)
+{
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+        std::cerr << "ERROR: Couldn't initialize Winsock.\n";
+        return false;
+    }
+    Socket_address socket_address;
+    if (!create_address(address, socket_address)) {
+        std::cerr << "ERROR: " << address << " isn't a port or a socket path.\n";
+        WSACleanup();
+        return false;
+    }
+
+    // A socket file left by an earlier run would make bind() fail.
+    if (socket_address.family == AF_UNIX) {
+        DeleteFileA(address.c_str());
+    }
+    const SOCKET listener = socket(socket_address.family, SOCK_STREAM, 0);
+    if (listener == INVALID_SOCKET || bind(listener, reinterpret_cast<const sockaddr*>(&socket_address.storage), socket_address.size) == SOCKET_ERROR || listen(listener, SOMAXCONN) == SOCKET_ERROR) {
+        std::cerr << "ERROR: Couldn't listen on " << address << ".\n";
+        if (listener != INVALID_SOCKET) {
+            closesocket(listener);
+        }
+        WSACleanup();
+        return false;
+    }
+    std::cout << "Coordinator: waiting for workers on " << address << "\n";
+
+    // Chunks are runs of consecutive batches of source, numbered in order.
+    // window holds the chunks from first on, until they're passed on, pending the ones to hand out again.
+    std::deque<std::vector<Sweep_batch>> window;
+    std::deque<char> finished;
+    long long first = 0;
+    std::deque<long long> pending;
+    bool exhausted = false;
+    bool stop = false;
+    int workers = 0;
+    int reassigned = 0;
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    // Serves one worker on its own thread.
+    const Wire_hello hello = create_hello();
+    auto serve = [&](SOCKET connection) {
+        Message_header header;
+        Wire_hello worker_hello;
+        if (!recv_all(connection, &header, sizeof(header)) || header.type != MESSAGE_HELLO || header.count != 1 || !recv_all(connection, &worker_hello, sizeof(worker_hello)) || std::memcmp(&worker_hello, &hello, sizeof(hello))) {
+            closesocket(connection);
+            return;
+        }
+        {
+            std::lock_guard lock(mutex);
+            ++workers;
+        }
+        while (true) {
+            long long i;
+            std::vector<Wire_point> points;
+            {
+                std::unique_lock lock(mutex);
+                changed.wait(lock, [&]() { return stop || !pending.empty() || (!exhausted && window.size() < window_chunks); });
+                if (stop) {
+                    break;
+                }
+                if (!pending.empty()) {
+                    i = pending.front();
+                    pending.pop_front();
+                }
+                else {
+                    std::vector<Sweep_batch> batches;
+                    Sweep_batch batch;
+                    while (static_cast<int>(batches.size()) < chunk && source(batch)) {
+                        batches.push_back(std::move(batch));
+                    }
+                    if (batches.empty()) {
+                        exhausted = true;
+                        changed.notify_all();
+                        continue;
+                    }
+                    i = first + static_cast<long long>(window.size());
+                    window.push_back(std::move(batches));
+                    finished.push_back(false);
+                }
+
+                // Chunks stay at their place in window until they're passed on.
+                for (const auto& batch : window[i - first]) {
+                    for (const auto& point : batch) {
+                        points.push_back({ point.params.radius, point.params.blur, point.params.p1, point.params.p2 });
+                    }
+                }
+            }
+            bool ok = send_message(connection, MESSAGE_CHUNK, points.data(), points.size());
+            std::vector<Wire_record> records(points.size());
+            size_t received = 0;
+            while (ok && received < records.size()) {
+                ok = recv_all(connection, &header, sizeof(header)) && header.type == MESSAGE_RECORDS && header.count <= records.size() - received;
+                ok = ok && recv_all(connection, records.data() + received, header.count * sizeof(Wire_record));
+                received += header.count;
+            }
+            std::lock_guard lock(mutex);
+            if (!ok) {
+                pending.push_front(i);
+                ++reassigned;
+                changed.notify_all();
+                closesocket(connection);
+                return;
+            }
+            const Wire_record* record = records.data();
+            for (auto& batch : window[i - first]) {
+                for (auto& point : batch) {
+                    point.result = record->result;
+                    point.error = record->error;
+                    ++record;
+                }
+            }
+            finished[i - first] = true;
+            changed.notify_all();
+        }
+        send_message(connection, MESSAGE_CHUNK, static_cast<const Wire_point*>(nullptr), 0);
+        closesocket(connection);
+    };
+
+    // Workers may come and go during the whole sweep.
+    std::vector<std::thread> connections;
+    std::thread acceptor([&]() {
+        while (true) {
+            {
+                std::lock_guard lock(mutex);
+                if (stop) {
+                    break;
+                }
+            }
+            fd_set set;
+            FD_ZERO(&set);
+            FD_SET(listener, &set);
+            timeval timeout = { 0, 100000 };
+            if (select(static_cast<int>(listener + 1), &set, nullptr, nullptr, &timeout) > 0) {
+                const SOCKET connection = accept(listener, nullptr, nullptr);
+                if (connection != INVALID_SOCKET) {
+                    connections.emplace_back(serve, connection);
+                }
+            }
+        }
+    });
+
+    // Finished chunks wait until all before them are passed on, like in Sweep::run(), which makes room for the next.
+    while (true) {
+        std::vector<Sweep_batch> batches;
+        {
+            std::unique_lock lock(mutex);
+            changed.wait(lock, [&]() { return (!window.empty() && finished.front()) || (exhausted && window.empty()); });
+            if (window.empty()) {
+                break;
+            }
+            batches = std::move(window.front());
+            window.pop_front();
+            finished.pop_front();
+            ++first;
+        }
+        changed.notify_all();
+        for (const auto& batch : batches) {
+            done(batch);
+        }
+    }
+    {
+        std::lock_guard lock(mutex);
+        stop = true;
+    }
+    changed.notify_all();
+    acceptor.join();
+    for (auto& connection : connections) {
+        connection.join();
+    }
+    closesocket(listener);
+    if (socket_address.family == AF_UNIX) {
+        DeleteFileA(address.c_str());
+    }
+    WSACleanup();
+    std::cout << "Workers: " << workers << ", reassigned chunks: " << reassigned << "\n";
+    return true;
+}
+
+bool run_worker(const std::string& address, Sweep& sweep)
+{
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+        std::cerr << "ERROR: Couldn't initialize Winsock.\n";
+        return false;
+    }
+    Socket_address socket_address;
+    if (!create_address(address, socket_address)) {
+        std::cerr << "ERROR: " << address << " isn't a port or a socket path.\n";
+        WSACleanup();
+        return false;
+    }
+
+    // The coordinator may still be loading its images, so connecting is retried for a while.
+    SOCKET connection = INVALID_SOCKET;
+    for (int attempt = 0; attempt < 100 && connection == INVALID_SOCKET; ++attempt) {
+        connection = socket(socket_address.family, SOCK_STREAM, 0);
+        if (connection != INVALID_SOCKET && connect(connection, reinterpret_cast<const sockaddr*>(&socket_address.storage), socket_address.size) == SOCKET_ERROR) {
+            closesocket(connection);
+            connection = INVALID_SOCKET;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+    if (connection == INVALID_SOCKET) {
+        std::cerr << "ERROR: Couldn't connect to " << address << ".\n";
+        WSACleanup();
+        return false;
+    }
+
+    const Wire_hello hello = create_hello();
+    bool ok = send_message(connection, MESSAGE_HELLO, &hello, 1);
+    long long evaluated = 0;
+    while (ok) {
+        Message_header header;
+        ok = recv_all(connection, &header, sizeof(header)) && header.type == MESSAGE_CHUNK;
+        if (!ok || !header.count) {
+            break;
+        }
+        std::vector<Wire_point> points(header.count);
+        ok = recv_all(connection, points.data(), points.size() * sizeof(Wire_point));
+        if (!ok) {
+            break;
+        }
+        std::vector<Sweep_batch> batches;
+        for (const auto& point : points) {
+            add_sweep_point(batches, { config::kernel, point.radius, point.blur, point.p1, point.p2 });
+        }
+
+        // Records go back as soon as their batch is done.
+        sweep.run(batches, [&](const Sweep_batch& batch) {
+            std::vector<Wire_record> records;
+            for (const auto& point : batch) {
+                records.push_back({ { point.params.radius, point.params.blur, point.params.p1, point.params.p2 }, point.result, point.error });
+            }
+            ok = ok && send_message(connection, MESSAGE_RECORDS, records.data(), records.size());
+        });
+        evaluated += points.size();
+    }
+    closesocket(connection);
+    WSACleanup();
+
+    // A rejected worker is disconnected right after its hello.
+    if (!ok) {
+        std::cerr << "ERROR: Lost the coordinator at " << address << ", or it has other images, kernel or score changing options.\n";
+        return false;
+    }
+    std::cout << "Worker: evaluated " << evaluated << " points\n";
+    return true;
+}
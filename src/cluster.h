@@ -0,0 +1,20 @@
+#pragma once
+
+#include "common.h"
+#include "sweep.h"
+
+// Sweeps spread over processes, see --coordinator and --worker.
+// The coordinator owns the grid and hands out chunks of batches to workers as they finish the previous ones,
+// workers evaluate them with their own Sweep and stream back a record per point as its batch finishes.
+// An address of only digits is a TCP port on localhost, anything else is the path of a Unix domain socket.
+
+// Evaluates the batches of source on the workers that connect to address, chunk batches at a time,
+// and passes each batch to done() on the calling thread in the order of source, like Sweep::run().
+// Chunks are taken from source as workers ask for them, up to window_chunks ahead of the first one not passed on yet.
+// The chunk of a worker that disconnects before finishing it is handed to the next worker that asks.
+// Returns false if it couldn't listen on address.
+bool run_coordinator(const std::string& address, const Sweep_source& source, int chunk, const std::function<void(const Sweep_batch&)>& done);
+
+// Evaluates chunks from the coordinator at address until it has none left.
+// Returns false if it couldn't connect or lost the coordinator.
+bool run_worker(const std::string& address, Sweep& sweep);
@@ -12,7 +12,27 @@
 #include "ensure.h"
 
 #include <array>
+#include <atomic>
+#include <cctype>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <fstream>
+#include <cstdio>
 #include <string>
-#include <iomanip>
\ No newline at end of file
+#include <thread>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <iomanip>
+#include <algorithm>
+#include <vector>
+#include <set>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <type_traits>
\ No newline at end of file
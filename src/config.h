@@ -21,4 +21,30 @@ namespace config
     inline float p2_hi;
     inline float p2_i;
     inline float ar;
+    inline bool cpu;
+    inline int batch;
+    inline bool fast_math;
+    inline bool half;
+    inline float sparse_eps;
+    inline bool box_reduce;
+    inline bool ssim_box;
+    inline int tile_threads;
+    inline int threads;
+    inline int screen_rank;
+    inline int screen_top;
+    inline int refine;
+    inline int refine_top;
+    inline int refine_div;
+    inline int optimizer;
+    inline int max_evals;
+    inline int restarts;
+    inline double x_tol;
+    inline double ssim_tol;
+    inline std::string coordinator;
+    inline std::string worker;
+    inline int chunk;
+
+    // Zero based.
+    inline int shard_index;
+    inline int shard_count;
 }
\ No newline at end of file
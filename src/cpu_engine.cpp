@@ -0,0 +1,429 @@
+#include "cpu_engine.h"
+#include "global.h"
+#include "config.h"
+
+void Cpu_engine::init()
+{
+    const Isa isa = detect_isa();
+    resample_pass = get_resample_pass(isa);
+
+    // Kernel is fixed for the whole sweep.
+    create_weight_table = get_create_weight_table(isa, config::kernel, !config::fast_math);
+    resample_cylindrical = get_resample_cylindrical(isa, config::kernel, !config::fast_math);
+    create_stencil_table = get_create_stencil_table(config::kernel);
+    apply_stencil_table = get_apply_stencil_table(isa);
+}
+
+void Cpu_engine::create_image(const void* data)
+{
+    // From sRGB to linear, for every 8 bit value.
+    std::array<float, 256> srgb_to_linear;
+    for (int i = 0; i < 256; ++i) {
+        const double c = i / 255.0;
+        srgb_to_linear[i] = static_cast<float>(c < 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+    }
+
+    // The source doesn't change during the sweep, so it's linearized once here.
+    create_plane(image, g_src_width, g_src_height);
+    create_plane(image_linear, g_src_width, g_src_height);
+    for (int y = 0; y < g_src_height; ++y) {
+        for (int x = 0; x < g_src_width; ++x) {
+            const uint8_t c = static_cast<const uint8_t*>(data)[x + y * g_src_width];
+            image.data[y * image.pitch + x] = c / 255.0f;
+            image_linear.data[y * image_linear.pitch + x] = srgb_to_linear[c];
+        }
+    }
+    block_rows(image, image_blocked);
+
+    // The reference doesn't change either.
+    create_ssim_reference(ssim_reference, g_reference_image_data, g_dst_width, g_dst_height);
+}
+
+// Only cylindrical resampling stores whole images.
+void Cpu_engine::create_pass_dst()
+{
+    if (pass_dst[0].data.empty()) {
+        for (auto& plane : pass_dst) {
+            create_plane(plane, g_dst_width, g_dst_height);
+        }
+    }
+}
+
+// All parameter sets have to share the same radius.
+void Cpu_engine::resample_images(const Kernel_params* params, int n)
+{
+    batch_params = params;
+    batch_size = n;
+    delinearize = scale < 1.0f;
+    pass_src = &image;
+    pass_scale = scale;
+    pass_factor = 1;
+    pass_streamed = false;
+    if (delinearize) {
+        pass_src = &image_linear;
+        if (box_reduce) {
+
+            // Largest factor of both axes that still leaves a downscale and divides the source.
+            // At integer ratios the full ratio would leave the kernel at 1:1, so it stays below the ratio.
+            int factor = std::min((g_src_width - 1) / g_dst_width, (g_src_height - 1) / g_dst_height);
+            while (factor > 1 && (g_src_width % factor != 0 || g_src_height % factor != 0)) {
+                --factor;
+            }
+            if (factor > 1) {
+                pass_box_reduce(factor);
+            }
+        }
+    }
+    screen_error.fill(0.0);
+    if (config::filter == 0) {
+        pass_orthogonal_resample();
+    }
+    else if (screen_rank > 0 && use_separable_approximation(params[0], pass_scale, pass_src->width, pass_src->height, g_dst_width, g_dst_height)) {
+        pass_cylindrical_screen();
+    }
+    else {
+        pass_cylindrical_resample();
+    }
+}
+
+double Cpu_engine::compare(int i)
+{
+    // Get SSIM between rescaled and reference image.
+    if (!pass_streamed) {
+        const Plane& plane = pass_dst[i];
+        pass_ssim[i].begin(ssim_reference);
+        for (int y = 0; y < g_dst_height; ++y) {
+            pass_ssim[i].add_row(plane.data.data() + static_cast<size_t>(y) * plane.pitch);
+        }
+    }
+    return pass_ssim[i].result();
+}
+
+double Cpu_engine::approximation_error(int i)
+{
+    return screen_error[i];
+}
+
+// Averages factor x factor blocks, in linear light.
+// The factor is fixed for the sweep, so it's done once.
+void Cpu_engine::pass_box_reduce(int factor)
+{
+    pass_scale = scale * static_cast<float>(factor);
+    if (!image_reduced.data.empty()) {
+        pass_src = &image_reduced;
+        return;
+    }
+    const int width = g_src_width / factor;
+    const int height = g_src_height / factor;
+    create_plane(image_reduced, width, height);
+    const float norm = 1.0f / static_cast<float>(factor * factor);
+    for (int y = 0; y < height; ++y) {
+        float* dst = image_reduced.data.data() + static_cast<size_t>(y) * image_reduced.pitch;
+        std::fill(dst, dst + width, 0.0f);
+        for (int i = 0; i < factor; ++i) {
+            const float* src = pass_src->data.data() + static_cast<size_t>(y * factor + i) * pass_src->pitch;
+            for (int x = 0; x < width; ++x) {
+                for (int j = 0; j < factor; ++j) {
+                    dst[x] += src[x * factor + j];
+                }
+            }
+        }
+        for (int x = 0; x < width; ++x) {
+            dst[x] *= norm;
+        }
+    }
+    pass_src = &image_reduced;
+}
+
+void Cpu_engine::pass_cylindrical_resample()
+{
+    const float ar = scale > 1.0f ? config::ar : -1.0f;
+    create_pass_dst();
+
+    // At ratios with few phases the kernel is evaluated once per stencil instead of once per tap of every pixel.
+    if (use_stencil_table(batch_params[0], pass_scale, pass_src->width, pass_src->height, g_dst_width, g_dst_height)) {
+        const Stencil_table* tables[max_batch];
+        for (int b = 0; b < batch_size; ++b) {
+            create_stencil_table(stencil_tables[b], batch_params[b], pass_scale, pass_src->width, pass_src->height, g_dst_width, g_dst_height);
+            tables[b] = &stencil_tables[b];
+        }
+        apply_stencil_table(*pass_src, tables, batch_size, ar, delinearize, pass_dst.data());
+    }
+    else {
+        resample_cylindrical(*pass_src, batch_params, batch_size, pass_scale, ar, delinearize, pass_dst.data());
+    }
+}
+
+// Sum of the separable terms of each parameter set, then the cylindrical antiringing.
+void Cpu_engine::pass_cylindrical_screen()
+{
+    const float ar = scale > 1.0f ? config::ar : -1.0f;
+    create_pass_dst();
+    const int terms = batch_size * screen_rank;
+    screen_table_x.resize(terms);
+    screen_table_y.resize(terms);
+    if (screen_terms.size() < static_cast<size_t>(terms)) {
+        screen_terms.resize(terms);
+        for (auto& plane : screen_terms) {
+            create_plane(plane, g_dst_width, g_dst_height);
+        }
+    }
+    for (int b = 0; b < batch_size; ++b) {
+        create_stencil_table(stencil_tables[b], batch_params[b], pass_scale, pass_src->width, pass_src->height, g_dst_width, g_dst_height);
+        screen_error[b] = create_separable_approximation(stencil_tables[b], screen_rank, pass_src->width, pass_src->height, g_dst_width, g_dst_height, &screen_table_x[b * screen_rank], &screen_table_y[b * screen_rank], screen_norm[b]);
+    }
+
+    // All terms share first and taps, so they are batched like parameter sets.
+    for (int t0 = 0; t0 < terms; t0 += max_batch) {
+        const int n = std::min(terms - t0, max_batch);
+        const Weight_table* tables_x[max_batch];
+        const Weight_table* tables_y[max_batch];
+        Lines dst[max_batch];
+        for (int t = 0; t < n; ++t) {
+            tables_x[t] = &screen_table_x[t0 + t];
+            tables_y[t] = &screen_table_y[t0 + t];
+            dst[t] = { screen_terms[t0 + t].data.data(), panel_lines, screen_terms[t0 + t].pitch };
+        }
+        resample_separable(tables_x, tables_y, n, -1.0f, dst);
+    }
+
+    const Plane& src = *pass_src;
+    const Stencil_table& stencils = stencil_tables[0];
+    for (int y = 0; y < g_dst_height; ++y) {
+        const int base_y = sample_base(y, src.height, g_dst_height);
+        for (int x = 0; x < g_dst_width; ++x) {
+            const int base_x = sample_base(x, src.width, g_dst_width);
+            const size_t stencil = static_cast<size_t>(y % stencils.phases_y) * stencils.phases_x + x % stencils.phases_x;
+
+            // Antiringing.
+            // The 2x2 taps nearest the sample give lo and hi.
+            float lo = 0.0f;
+            float hi = 0.0f;
+            if (ar > 0.0f) {
+                const int x0 = std::clamp(base_x, 0, src.width - 1);
+                const int x1 = std::clamp(base_x + 1, 0, src.width - 1);
+                const float* row0 = src.data.data() + static_cast<size_t>(std::clamp(base_y, 0, src.height - 1)) * src.pitch;
+                const float* row1 = src.data.data() + static_cast<size_t>(std::clamp(base_y + 1, 0, src.height - 1)) * src.pitch;
+                lo = std::min({ row0[x0], row0[x1], row1[x0], row1[x1] });
+                hi = std::max({ row0[x0], row0[x1], row1[x0], row1[x1] });
+            }
+
+            for (int b = 0; b < batch_size; ++b) {
+                float result = 0.0f;
+                for (int k = 0; k < screen_rank; ++k) {
+                    result += screen_terms[b * screen_rank + k].data[static_cast<size_t>(y) * screen_terms[0].pitch + x];
+                }
+                result /= screen_norm[b][stencil];
+
+                // Antiringing.
+                if (ar > 0.0f) {
+                    result += (std::clamp(result, lo, hi) - result) * ar;
+                }
+
+                pass_dst[b].data[static_cast<size_t>(y) * pass_dst[b].pitch + x] = delinearize ? linear_to_srgb(result) : result;
+            }
+        }
+    }
+}
+
+void Cpu_engine::pass_orthogonal_resample()
+{
+    // Antiringing of the box averages would be meaningless, so upscales with antiringing resample at full size,
+    // the sweep has to rank the image it reports.
+    if (ssim_box && !(scale > 1.0f && config::ar > 0.0f)) {
+        pass_factor = ssim_reference.factor;
+    }
+    const float ar = scale > 1.0f && pass_factor == 1 ? config::ar : -1.0f;
+    const Weight_table* tables_x[max_batch];
+    const Weight_table* tables_y[max_batch];
+    Lines dst[max_batch];
+    for (int b = 0; b < batch_size; ++b) {
+        create_weight_table(table_x[b], batch_params[b], pass_scale, pass_src->width, g_dst_width);
+        create_weight_table(table_y[b], batch_params[b], pass_scale, pass_src->height, g_dst_height);
+        sparsify_weight_table(table_x[b], sparse_epsilon);
+        sparsify_weight_table(table_y[b], sparse_epsilon);
+        fold_weight_table(table_x[b]);
+        fold_weight_table(table_y[b]);
+        tables_x[b] = &table_x[b];
+        tables_y[b] = &table_y[b];
+        if (pass_factor > 1) {
+            create_box_weight_table(box_table_x[b], table_x[b], g_dst_width, pass_factor);
+            create_box_weight_table(box_table_y[b], table_y[b], g_dst_height, pass_factor);
+            tables_x[b] = &box_table_x[b];
+            tables_y[b] = &box_table_y[b];
+        }
+        dst[b] = { nullptr, panel_lines, round_up(g_dst_width / pass_factor, panel_lines), nullptr, delinearize };
+    }
+    resample_separable(tables_x, tables_y, batch_size, ar, dst, pass_ssim.data());
+    pass_streamed = true;
+}
+
+// Tables of the same index have to share first and taps, up to max_batch of them.
+// If ssim is set the results go to it instead of dst, whose data is ignored.
+void Cpu_engine::resample_separable(const Weight_table* const* tables_x, const Weight_table* const* tables_y, int n, float ar, const Lines* dst, Streaming_ssim* ssim)
+{
+    if (ssim) {
+        resample_tiles(tables_x, tables_y, n, ar, dst, ssim);
+        return;
+    }
+    Plane& src = *pass_src;
+    const int dst_width = g_dst_width / pass_factor;
+    const int dst_height = g_dst_height / pass_factor;
+
+    // Pick the pass order with fewer multiply-adds.
+    // Antiringing clamps after each pass, so the order changes the result, keep the shader's order then.
+    // Only the first pass reads the source, so only that one is batched.
+    const long long cost_x_first = static_cast<long long>(src.height) * dst_width * tables_x[0]->taps + static_cast<long long>(dst_height) * dst_width * tables_y[0]->taps;
+    const long long cost_y_first = static_cast<long long>(src.width) * dst_height * tables_y[0]->taps + static_cast<long long>(dst_height) * dst_width * tables_x[0]->taps;
+    Lines intermediate[max_batch];
+    auto create_intermediate = [&](int b, size_t size, ptrdiff_t panel, ptrdiff_t step) -> Lines {
+
+        // Half floats halve the memory traffic between the passes.
+        if (half_intermediate) {
+            pass_intermediate_half[b].resize(size);
+            return { nullptr, panel, step, pass_intermediate_half[b].data() };
+        }
+        pass_intermediate[b].resize(size);
+        return { pass_intermediate[b].data(), panel, step };
+    };
+    if (ar > 0.0f || cost_y_first <= cost_x_first) {
+
+        // Pass y axis, columns of the source are the lines.
+        // The intermediate is stored in panels of rows, so the x pass reads them as lines too.
+        for (int b = 0; b < n; ++b) {
+            intermediate[b] = create_intermediate(b, static_cast<size_t>(tables_y[b]->size) * src.pitch, static_cast<ptrdiff_t>(src.pitch) * panel_lines, panel_lines);
+        }
+        resample_pass({ src.data.data(), panel_lines, src.pitch }, src.pitch, tables_y, n, ar, intermediate, true);
+
+        // Pass x axis.
+        for (int b = 0; b < n; ++b) {
+            resample_pass(intermediate[b], tables_y[b]->size, tables_x + b, 1, ar, &dst[b], true);
+        }
+    }
+    else {
+
+        // Pass x axis, rows of the source are the lines.
+        float* blocked = image_blocked.data();
+        if (pass_src != &image) {
+
+            // Linear and reduced sources don't change either, they're blocked once too.
+            if (pass_blocked_src != pass_src) {
+                block_rows(src, pass_blocked);
+                pass_blocked_src = pass_src;
+            }
+            blocked = pass_blocked.data();
+        }
+        for (int b = 0; b < n; ++b) {
+            intermediate[b] = create_intermediate(b, static_cast<size_t>(round_up(src.height, panel_lines)) * tables_x[b]->size, panel_lines, tables_x[b]->size);
+        }
+        resample_pass({ blocked, static_cast<ptrdiff_t>(src.pitch) * panel_lines, panel_lines }, round_up(src.height, panel_lines), tables_x, n, ar, intermediate, true);
+
+        // Pass y axis.
+        for (int b = 0; b < n; ++b) {
+            resample_pass(intermediate[b], tables_x[b]->size, tables_y + b, 1, ar, &dst[b], false);
+        }
+    }
+}
+
+// Tables of the same index have to share first and taps, up to max_batch of them.
+// The results go to ssim, their rows are scored in bands while they're still in cache.
+// Streaming needs the rows in order, so the y axis is always passed first.
+void Cpu_engine::resample_tiles(const Weight_table* const* tables_x, const Weight_table* const* tables_y, int n, float ar, const Lines* dst, Streaming_ssim* ssim)
+{
+    // Tiles of at least this many map rows, so the halos stay small next to them.
+    constexpr int min_tile_rows = 64;
+
+    // A few tiles per thread even out the work, a single thread evaluates the whole map as one tile.
+    const int map_height = ssim_reference.sub_height - ssim_window + 1;
+    const int tiles = tile_threads > 1 ? std::clamp(map_height / min_tile_rows, 1, 2 * tile_threads) : 1;
+    const int threads = std::min(tile_threads, tiles);
+    if (tile_workspaces.size() < static_cast<size_t>(threads)) {
+        tile_workspaces.resize(threads);
+    }
+    tile_ssim.resize(static_cast<size_t>(tiles) * max_batch);
+    std::atomic<int> next_tile = 0;
+    auto worker = [&](int thread) {
+        for (int t = next_tile++; t < tiles; t = next_tile++) {
+            Streaming_ssim* partial = &tile_ssim[static_cast<size_t>(t) * max_batch];
+            for (int b = 0; b < n; ++b) {
+                partial[b].begin(ssim_reference, t * map_height / tiles, (t + 1) * map_height / tiles);
+            }
+            resample_tile(tables_x, tables_y, n, ar, dst, tile_workspaces[thread], partial);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int thread = 1; thread < threads; ++thread) {
+        workers.emplace_back(worker, thread);
+    }
+    worker(0);
+    for (auto& thread : workers) {
+        thread.join();
+    }
+
+    // Merge the partial sums in tile order, whichever thread took them.
+    for (int b = 0; b < n; ++b) {
+        ssim[b].begin(ssim_reference);
+        for (int t = 0; t < tiles; ++t) {
+            ssim[b].merge(tile_ssim[static_cast<size_t>(t) * max_batch + b]);
+        }
+    }
+}
+
+// Resamples the rows ssim needs, from the start of their panel.
+void Cpu_engine::resample_tile(const Weight_table* const* tables_x, const Weight_table* const* tables_y, int n, float ar, const Lines* dst, Tile_workspace& workspace, Streaming_ssim* ssim)
+{
+    Plane& src = *pass_src;
+    const bool subsampled = pass_factor > 1;
+    const int row_begin = ssim[0].first_row(subsampled);
+    const int row_end = ssim[0].end_row(subsampled);
+    const int slice_begin = row_begin / panel_lines * panel_lines;
+    const int slice_size = round_up(row_end - slice_begin, panel_lines);
+
+    // Pass y axis over the rows of the tile, columns of the source are the lines.
+    const Weight_table* slices[max_batch];
+    Lines intermediate[max_batch];
+    const size_t size = static_cast<size_t>(slice_size) * src.pitch;
+    for (int b = 0; b < n; ++b) {
+        slices[b] = tables_y[b];
+        if (slice_size < tables_y[b]->size) {
+            slice_weight_table(*tables_y[b], slice_begin, slice_size, workspace.table_y[b]);
+            slices[b] = &workspace.table_y[b];
+        }
+
+        // Half floats halve the memory traffic between the passes.
+        if (half_intermediate) {
+            workspace.intermediate_half[b].resize(size);
+            intermediate[b] = { nullptr, static_cast<ptrdiff_t>(src.pitch) * panel_lines, panel_lines, workspace.intermediate_half[b].data() };
+        }
+        else {
+            workspace.intermediate[b].resize(size);
+            intermediate[b] = { workspace.intermediate[b].data(), static_cast<ptrdiff_t>(src.pitch) * panel_lines, panel_lines };
+        }
+    }
+    resample_pass({ src.data.data(), panel_lines, src.pitch }, src.pitch, slices, n, ar, intermediate, true);
+
+    // Pass x axis, one panel of rows at a time into the band, scored while it's still in cache.
+    workspace.band.resize(static_cast<size_t>(panel_lines) * dst[0].step);
+    for (int y0 = slice_begin; y0 < row_end; y0 += panel_lines) {
+        for (int b = 0; b < n; ++b) {
+            Lines panel = intermediate[b];
+            if (panel.half) {
+                panel.half += (y0 - slice_begin) / panel_lines * panel.panel;
+            }
+            else {
+                panel.data += (y0 - slice_begin) / panel_lines * panel.panel;
+            }
+            const Lines band = { workspace.band.data(), panel_lines, dst[b].step, nullptr, dst[b].srgb };
+            resample_pass(panel, panel_lines, tables_x + b, 1, ar, &band, true);
+            for (int y = std::max(row_begin, y0); y < std::min(y0 + panel_lines, row_end); ++y) {
+                const float* row = workspace.band.data() + static_cast<size_t>(y - y0) * dst[b].step;
+                if (subsampled) {
+                    ssim[b].add_subsampled_row(row);
+                }
+                else {
+                    ssim[b].add_row(row);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "common.h"
+#include "resample.h"
+#include "ssim.h"
+
+// Buffers of one thread of the tiled evaluation.
+struct Tile_workspace
+{
+    std::array<Weight_table, max_batch> table_y;
+    std::array<std::vector<float>, max_batch> intermediate;
+    std::array<std::vector<uint16_t>, max_batch> intermediate_half;
+
+    // Rows of the last pass before they're scored.
+    std::vector<float> band;
+};
+
+// Same passes as Engine, but resamples on the CPU.
+// Up to max_batch parameter sets of the same radius are resampled in one traversal of the source.
+// Orthogonal results are scored while they're resampled, a band of rows at a time, and never stored in full.
+class Cpu_engine
+{
+public:
+    void init();
+    void create_image(const void* data);
+    void resample_images(const Kernel_params* params, int n);
+    double compare(int i);
+
+    // Relative error of the separable approximation of the last batch, 0 if it was resampled exactly.
+    double approximation_error(int i);
+    float scale;
+
+    // Store the intermediate between the orthogonal passes as half floats.
+    bool half_intermediate;
+
+    // Taps of the orthogonal weight tables not above this are dropped, see sparsify_weight_table().
+    float sparse_epsilon;
+
+    // Screen cylindrical candidates with this many separable terms, 0 resamples exactly.
+    int screen_rank;
+
+    // When downscaling, average blocks of the largest integer factor that divides the source first.
+    bool box_reduce;
+
+    // Resample orthogonal candidates straight to the grid SSIM subsamples them to, see create_box_weight_table().
+    // Drops antiringing and delinearizes the box averages, so it's exact only when upscaling without antiringing.
+    bool ssim_box;
+
+    // Split orthogonal candidates into bands of SSIM map rows, with the halos of the window and the kernel,
+    // and evaluate them on this many threads.
+    int tile_threads;
+private:
+    void pass_box_reduce(int factor);
+    void pass_cylindrical_resample();
+    void pass_cylindrical_screen();
+    void pass_orthogonal_resample();
+    void create_pass_dst();
+    void resample_separable(const Weight_table* const* tables_x, const Weight_table* const* tables_y, int n, float ar, const Lines* dst, Streaming_ssim* ssim = nullptr);
+    void resample_tiles(const Weight_table* const* tables_x, const Weight_table* const* tables_y, int n, float ar, const Lines* dst, Streaming_ssim* ssim);
+    void resample_tile(const Weight_table* const* tables_x, const Weight_table* const* tables_y, int n, float ar, const Lines* dst, Tile_workspace& workspace, Streaming_ssim* ssim);
+    Resample_pass resample_pass;
+    Create_weight_table create_weight_table;
+    Resample_cylindrical resample_cylindrical;
+    Create_stencil_table create_stencil_table;
+    Apply_stencil_table apply_stencil_table;
+    Plane image;
+    std::vector<float> image_blocked;
+    Plane image_linear;
+    Plane image_reduced;
+    std::vector<float> pass_blocked;
+    const Plane* pass_blocked_src = nullptr;
+    std::array<std::vector<float>, max_batch> pass_intermediate;
+    std::array<std::vector<uint16_t>, max_batch> pass_intermediate_half;
+    std::array<Weight_table, max_batch> table_x;
+    std::array<Weight_table, max_batch> table_y;
+    std::array<Weight_table, max_batch> box_table_x;
+    std::array<Weight_table, max_batch> box_table_y;
+    std::array<Stencil_table, max_batch> stencil_tables;
+
+    // Separable terms of the screened batch, screen_rank per parameter set.
+    std::vector<Weight_table> screen_table_x;
+    std::vector<Weight_table> screen_table_y;
+    std::vector<Plane> screen_terms;
+    std::array<std::vector<float>, max_batch> screen_norm;
+    std::array<double, max_batch> screen_error;
+
+    // Parameter sets of the current batch.
+    const Kernel_params* batch_params;
+    int batch_size;
+
+    // Input of the next pass and the scale it gets resampled by.
+    Plane* pass_src;
+    float pass_scale;
+
+    // The last pass resamples to the reference subsampled by this factor, 1 is the reference itself.
+    int pass_factor;
+
+    // Downscaling resamples in linear light, the last pass stores sRGB.
+    bool delinearize;
+
+    std::array<Plane, max_batch> pass_dst;
+
+    // SSIM of the last batch if it was streamed, else it's computed from pass_dst.
+    Ssim_reference ssim_reference;
+    std::array<Streaming_ssim, max_batch> pass_ssim;
+    bool pass_streamed;
+
+    // Tiles of the last batch, max_batch per tile.
+    std::vector<Streaming_ssim> tile_ssim;
+    std::vector<Tile_workspace> tile_workspaces;
+};
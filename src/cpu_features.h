@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.h"
+
+#include <intrin.h>
+
+// enum ISA_
+enum Isa
+{
+    ISA_SCALAR,
+    ISA_AVX2,
+    ISA_AVX512
+};
+
+// Returns the widest instruction set the CPU and the OS both support.
+inline Isa detect_isa()
+{
+    int regs[4];
+    __cpuidex(regs, 0, 0);
+    const int max_leaf = regs[0];
+    if (max_leaf < 7) {
+        return ISA_SCALAR;
+    }
+
+    // OS has to save ymm (and zmm) state.
+    __cpuidex(regs, 1, 0);
+    const bool osxsave = regs[2] & (1 << 27);
+    const bool fma = regs[2] & (1 << 12);
+    const bool f16c = regs[2] & (1 << 29);
+    if (!osxsave) {
+        return ISA_SCALAR;
+    }
+    const unsigned long long xcr0 = _xgetbv(0);
+    const bool ymm = (xcr0 & 0x06) == 0x06;
+    const bool zmm = (xcr0 & 0xe6) == 0xe6;
+
+    __cpuidex(regs, 7, 0);
+    const bool avx2 = regs[1] & (1 << 5);
+    const bool avx512f = regs[1] & (1 << 16);
+
+    if (avx512f && zmm) {
+        return ISA_AVX512;
+    }
+    if (avx2 && fma && f16c && ymm) {
+        return ISA_AVX2;
+    }
+    return ISA_SCALAR;
+}
+
+inline const char* isa_name(Isa isa)
+{
+    switch (isa) {
+        case ISA_AVX2:
+            return "AVX2";
+        case ISA_AVX512:
+            return "AVX-512";
+        default:
+            return "scalar";
+    }
+}
@@ -55,18 +55,18 @@ void Engine::create_image(const void* data)
     ensure(device->CreateShaderResourceView(texture2d.Get(), nullptr, srv_image.ReleaseAndGetAddressOf()), == S_OK);
 }
 
-void Engine::resample_image()
+void Engine::resample_image(const Kernel_params& params)
 {
-    static const bool linearize = scale < 1.0f;
+    const bool linearize = scale < 1.0f;
     srv_pass = srv_image;
     if (linearize) {
         pass_linearize();
     }
     if (config::filter == 0) {
-        pass_orthogonal_resample();
+        pass_orthogonal_resample(params);
     }
     else {
-        pass_cylindrical_resample();
+        pass_cylindrical_resample(params);
     }
     if (linearize) {
         pass_delinearize();
@@ -237,17 +237,17 @@ void Engine::pass_delinearize()
     draw_pass(g_dst_width, g_dst_height);
 }
 
-void Engine::pass_cylindrical_resample()
+void Engine::pass_cylindrical_resample(const Kernel_params& params)
 {
     alignas(16) Cb_data data[3];
-    data[0].x.i = config::kernel; // index
-    data[0].y.f = g_kernel_radius; // radius
-    data[0].z.f = g_kernel_blur; // blur
-    data[0].w.f = g_kernel_parameter1; // p1
-    data[1].x.f = g_kernel_parameter2; // p2
+    data[0].x.i = params.index; // index
+    data[0].y.f = params.radius; // radius
+    data[0].z.f = params.blur; // blur
+    data[0].w.f = params.p1; // p1
+    data[1].x.f = params.p2; // p2
     data[1].y.f = scale > 1.0f ? config::ar : -1.0f; // ar
     data[1].z.f = std::min(scale, 1.0f); // scale
-    data[1].w.f = std::ceil(g_kernel_radius / std::min(scale, 1.0f)); // bound
+    data[1].w.f = std::ceil(params.radius / std::min(scale, 1.0f)); // bound
     data[2].x.f = g_src_width; // dims.x
     data[2].y.f = g_src_height; // dims.y
     data[2].z.f = 1.0f / static_cast<float>(g_src_width); // pt.x
@@ -259,18 +259,18 @@ void Engine::pass_cylindrical_resample()
     draw_pass(g_dst_width, g_dst_height);
 }
 
-void Engine::pass_orthogonal_resample()
+void Engine::pass_orthogonal_resample(const Kernel_params& params)
 {
     // Pass y axis.
     alignas(16) Cb_data data[4];
-    data[0].x.i = config::kernel; // index
-    data[0].y.f = g_kernel_radius; // radius
-    data[0].z.f = g_kernel_blur; // blur
-    data[0].w.f = g_kernel_parameter1; // p1
-    data[1].x.f = g_kernel_parameter2; // p2
+    data[0].x.i = params.index; // index
+    data[0].y.f = params.radius; // radius
+    data[0].z.f = params.blur; // blur
+    data[0].w.f = params.p1; // p1
+    data[1].x.f = params.p2; // p2
     data[1].y.f = scale > 1.0f ? config::ar : -1.0f; // ar
     data[1].z.f = std::min(scale, 1.0f); // scale
-    data[1].w.f = std::ceil(g_kernel_radius / std::min(scale, 1.0f)); // bound
+    data[1].w.f = std::ceil(params.radius / std::min(scale, 1.0f)); // bound
     data[2].x.f = g_src_width; // dims.x
     data[2].y.f = g_src_height; // dims.y
     data[2].z.f = 1.0f / static_cast<float>(g_src_width); // pt.x
@@ -1,13 +1,14 @@
 #pragma once
 
 #include "common.h"
+#include "kernel_functions.h"
 
 class Engine
 {
 public:
     void init();
     void create_image(const void* data);
-    void resample_image();
+    void resample_image(const Kernel_params& params);
     double compare();
     float scale;
 private:
@@ -22,8 +23,8 @@ private:
 	void create_viewport(float width, float height);
     void pass_linearize();
     void pass_delinearize();
-    void pass_cylindrical_resample();
-    void pass_orthogonal_resample();
+    void pass_cylindrical_resample(const Kernel_params& params);
+    void pass_orthogonal_resample(const Kernel_params& params);
     Microsoft::WRL::ComPtr<ID3D11Device> device;
 	Microsoft::WRL::ComPtr<ID3D11DeviceContext> device_context;
     Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv_pass;
@@ -1,13 +1,19 @@
 #pragma once
 
 #include "common.h"
+#include "kernel_plugin.h"
 
-inline float g_kernel_radius;
-inline float g_kernel_blur;
-inline float g_kernel_parameter1;
-inline float g_kernel_parameter2;
 inline int g_src_width;
 inline int g_src_height;
 inline int g_dst_width;
 inline int g_dst_height;
-inline uint8_t* g_reference_image_data;
\ No newline at end of file
+inline uint8_t* g_reference_image_data;
+
+// Loaded by --kernel-plugin, CPU only.
+inline const Kernel_plugin* g_kernel_plugin;
+
+// FNV-1a of the DLL or expression text of g_kernel_plugin and of both images,
+// workers of a --coordinator have to resample the same ones.
+inline uint64_t g_kernel_plugin_hash;
+inline uint64_t g_scaled_image_hash;
+inline uint64_t g_reference_image_hash;
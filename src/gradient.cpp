@@ -0,0 +1,338 @@
+#include "gradient.h"
+#include "resample.h"
+#include "global.h"
+#include "config.h"
+
+// Parameters the gradient is in, in its order.
+static constexpr std::array<double kernels::Kernel::*, 3> gradient_parameters = { &kernels::Kernel::blur, &kernels::Kernel::p1, &kernels::Kernel::p2 };
+
+// Kernels are written once for double and SIMD vectors and have no derivatives of their own,
+// so each parameter is stepped both ways, blur relative to itself as it has to stay positive.
+// In double the central difference is accurate to ~1e-10 relative.
+template <typename Kernel>
+static void create_gradient_table(Gradient_table& table, const Kernel_params& k, float scale, int src_size, int dst_size)
+{
+    const Kernel kernel(k);
+    std::array<Kernel, 3> plus;
+    std::array<Kernel, 3> minus;
+    std::array<double, 3> steps;
+    for (int p = 0; p < 3; ++p) {
+        const double value = kernel.*gradient_parameters[p];
+        steps[p] = 1e-5 * std::max(std::abs(value), p == 0 ? 0.0 : 1.0);
+        plus[p] = kernel;
+        plus[p].*gradient_parameters[p] += steps[p];
+        minus[p] = kernel;
+        minus[p].*gradient_parameters[p] -= steps[p];
+    }
+
+    const float s = std::min(scale, 1.0f);
+    const int bound = static_cast<int>(std::ceil(k.radius / s));
+    table.taps = 2 * bound;
+    table.first.resize(dst_size);
+    table.weights.resize(static_cast<size_t>(dst_size) * table.taps);
+    for (auto& derivative : table.derivatives) {
+        derivative.resize(table.weights.size());
+    }
+    for (int o = 0; o < dst_size; ++o) {
+        const double f = sample_fraction(o, src_size, dst_size);
+        table.first[o] = sample_base(o, src_size, dst_size) + 1 - bound;
+        double* w = &table.weights[static_cast<size_t>(o) * table.taps];
+        std::array<double*, 3> dw;
+        for (int p = 0; p < 3; ++p) {
+            dw[p] = &table.derivatives[p][static_cast<size_t>(o) * table.taps];
+        }
+        double wsum = 0.0;
+        std::array<double, 3> dwsum = {};
+        for (int i = 0; i < table.taps; ++i) {
+            const double x = std::abs((i + 1 - bound - f) * s);
+            w[i] = kernel(x);
+            wsum += w[i];
+            for (int p = 0; p < 3; ++p) {
+                dw[p][i] = (plus[p](x) - minus[p](x)) / (2.0 * steps[p]);
+                dwsum[p] += dw[p][i];
+            }
+        }
+
+        // Normalize weights, d(w / sum) = (dw - w / sum * dsum) / sum.
+        for (int i = 0; i < table.taps; ++i) {
+            w[i] /= wsum;
+            for (int p = 0; p < 3; ++p) {
+                dw[p][i] = (dw[p][i] - w[i] * dwsum[p]) / wsum;
+            }
+        }
+    }
+}
+
+template <typename Kernel>
+struct Create_gradient_table_instance
+{
+    static constexpr Create_gradient_table function = create_gradient_table<Kernel>;
+};
+
+// Separable Gaussian of ImageMetrics::Filter() over a whole image, valid region only.
+static void filter(const std::vector<double>& in, int width, int height, std::vector<double>& out)
+{
+    static const std::array<double, ssim_window> window = gaussian_window();
+    const int out_width = width - ssim_window + 1;
+    const int out_height = height - ssim_window + 1;
+    std::vector<double> horizontal(static_cast<size_t>(height) * out_width);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < out_width; ++x) {
+            double sum = 0.0;
+            for (int i = 0; i < ssim_window; ++i) {
+                sum += in[static_cast<size_t>(y) * width + x + i] * window[i];
+            }
+            horizontal[static_cast<size_t>(y) * out_width + x] = sum;
+        }
+    }
+    out.assign(static_cast<size_t>(out_height) * out_width, 0.0);
+    for (int y = 0; y < out_height; ++y) {
+        for (int i = 0; i < ssim_window; ++i) {
+            for (int x = 0; x < out_width; ++x) {
+                out[static_cast<size_t>(y) * out_width + x] += horizontal[static_cast<size_t>(y + i) * out_width + x] * window[i];
+            }
+        }
+    }
+}
+
+// Transpose of filter(), spreads each value of the valid region back over the window it was filtered from.
+static void filter_transposed(const std::vector<double>& in, int width, int height, std::vector<double>& out)
+{
+    static const std::array<double, ssim_window> window = gaussian_window();
+    const int in_width = width - ssim_window + 1;
+    const int in_height = height - ssim_window + 1;
+    std::vector<double> vertical(static_cast<size_t>(height) * in_width, 0.0);
+    for (int y = 0; y < in_height; ++y) {
+        for (int i = 0; i < ssim_window; ++i) {
+            for (int x = 0; x < in_width; ++x) {
+                vertical[static_cast<size_t>(y + i) * in_width + x] += in[static_cast<size_t>(y) * in_width + x] * window[i];
+            }
+        }
+    }
+    out.assign(static_cast<size_t>(height) * width, 0.0);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < in_width; ++x) {
+            const double value = vertical[static_cast<size_t>(y) * in_width + x];
+            for (int i = 0; i < ssim_window; ++i) {
+                out[static_cast<size_t>(y) * width + x + i] += value * window[i];
+            }
+        }
+    }
+}
+
+void Ssim_gradient::init(const uint8_t* scaled_image_data)
+{
+    scale = static_cast<float>(g_dst_width) / static_cast<float>(g_src_width);
+    delinearize = scale < 1.0f;
+    create_gradient_table = select_kernel<false, Create_gradient_table_instance>(config::kernel);
+
+    // Same source as Cpu_engine, linear when downscaling.
+    image.resize(static_cast<size_t>(g_src_width) * g_src_height);
+    for (size_t i = 0; i < image.size(); ++i) {
+        const double c = scaled_image_data[i] / 255.0;
+        image[i] = static_cast<float>(!delinearize ? c : c < 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+    }
+    for (auto& plane : intermediate) {
+        plane.resize(static_cast<size_t>(g_dst_height) * g_src_width);
+    }
+    for (auto& plane : output) {
+        plane.resize(static_cast<size_t>(g_dst_height) * g_dst_width);
+    }
+    create_ssim_reference(ssim_reference, g_reference_image_data, g_dst_width, g_dst_height);
+}
+
+double Ssim_gradient::evaluate(const Kernel_params& params, std::array<double, 3>& gradient)
+{
+    create_gradient_table(table_x, params, scale, g_src_width, g_dst_width);
+    create_gradient_table(table_y, params, scale, g_src_height, g_dst_height);
+    const float ar = scale > 1.0f ? config::ar : -1.0f;
+    pass_y(ar);
+    pass_x(ar);
+    return score(gradient);
+}
+
+// Rows of the output, the source has no derivatives.
+void Ssim_gradient::pass_y(float ar)
+{
+    const int width = g_src_width;
+    const int bound = table_y.taps / 2;
+    std::array<std::vector<double>, 4> sums;
+    for (auto& sum : sums) {
+        sum.resize(width);
+    }
+    auto row = [&](int i) {
+        return image.data() + static_cast<size_t>(std::clamp(i, 0, g_src_height - 1)) * width;
+    };
+    for (int o = 0; o < g_dst_height; ++o) {
+        for (auto& sum : sums) {
+            std::fill(sum.begin(), sum.end(), 0.0);
+        }
+        for (int i = 0; i < table_y.taps; ++i) {
+            const float* src = row(table_y.first[o] + i);
+            const size_t tap = static_cast<size_t>(o) * table_y.taps + i;
+            const double w = table_y.weights[tap];
+            for (int x = 0; x < width; ++x) {
+                sums[0][x] += src[x] * w;
+            }
+            for (int p = 0; p < 3; ++p) {
+                const double dw = table_y.derivatives[p][tap];
+                for (int x = 0; x < width; ++x) {
+                    sums[p + 1][x] += src[x] * dw;
+                }
+            }
+        }
+
+        // Antiringing.
+        // A clamped result moves towards a source sample, so only its share of the derivatives is left.
+        if (ar > 0.0f) {
+            const float* src0 = row(table_y.first[o] + bound - 1);
+            const float* src1 = row(table_y.first[o] + bound);
+            for (int x = 0; x < width; ++x) {
+                const double clamped = std::clamp<double>(sums[0][x], std::min(src0[x], src1[x]), std::max(src0[x], src1[x]));
+                if (clamped != sums[0][x]) {
+                    sums[0][x] += (clamped - sums[0][x]) * ar;
+                    for (int p = 0; p < 3; ++p) {
+                        sums[p + 1][x] *= 1.0 - ar;
+                    }
+                }
+            }
+        }
+
+        for (int c = 0; c < 4; ++c) {
+            std::copy(sums[c].begin(), sums[c].end(), intermediate[c].begin() + static_cast<size_t>(o) * width);
+        }
+    }
+}
+
+// Columns of the output, d(sum w v) = sum dw v + sum w dv.
+void Ssim_gradient::pass_x(float ar)
+{
+    const int bound = table_x.taps / 2;
+    for (int y = 0; y < g_dst_height; ++y) {
+        std::array<const float*, 4> src;
+        std::array<float*, 4> dst;
+        for (int c = 0; c < 4; ++c) {
+            src[c] = intermediate[c].data() + static_cast<size_t>(y) * g_src_width;
+            dst[c] = output[c].data() + static_cast<size_t>(y) * g_dst_width;
+        }
+        for (int o = 0; o < g_dst_width; ++o) {
+            std::array<double, 4> sum = {};
+            for (int i = 0; i < table_x.taps; ++i) {
+                const int x = std::clamp(table_x.first[o] + i, 0, g_src_width - 1);
+                const size_t tap = static_cast<size_t>(o) * table_x.taps + i;
+                const double w = table_x.weights[tap];
+                sum[0] += src[0][x] * w;
+                for (int p = 0; p < 3; ++p) {
+                    sum[p + 1] += src[0][x] * table_x.derivatives[p][tap] + src[p + 1][x] * w;
+                }
+            }
+
+            // Antiringing.
+            // The samples it clamps to have derivatives of their own now, they get the share ar of the result's.
+            if (ar > 0.0f) {
+                const int x0 = std::clamp(table_x.first[o] + bound - 1, 0, g_src_width - 1);
+                const int x1 = std::clamp(table_x.first[o] + bound, 0, g_src_width - 1);
+                const int lo = src[0][x0] <= src[0][x1] ? x0 : x1;
+                const int hi = lo == x0 ? x1 : x0;
+                const int bound_x = sum[0] < src[0][lo] ? lo : sum[0] > src[0][hi] ? hi : -1;
+                if (bound_x >= 0) {
+                    for (int c = 0; c < 4; ++c) {
+                        sum[c] += (src[c][bound_x] - sum[c]) * ar;
+                    }
+                }
+            }
+
+            // Delinearize, same as linear_to_srgb().
+            if (delinearize) {
+                const double derivative = sum[0] < 0.0031308 ? 12.92 : 1.055 / 2.4 * std::pow(sum[0], 1.0 / 2.4 - 1.0);
+                sum[0] = linear_to_srgb(sum[0]);
+                for (int p = 0; p < 3; ++p) {
+                    sum[p + 1] *= derivative;
+                }
+            }
+
+            for (int c = 0; c < 4; ++c) {
+                dst[c][o] = static_cast<float>(sum[c]);
+            }
+        }
+    }
+}
+
+// SSIM is the mean of the map s = (2 mu1 mu2 + c1) (2 sigma12 + c2) / ((mu1^2 + mu2^2 + c1) (sigma1^2 + sigma2^2 + c2)),
+// which depends on the image only through the Gaussian moments mu1, E[x^2] = sigma1^2 + mu1^2 and E[x y] = sigma12 + mu1 mu2.
+// The derivatives of the map in them are filtered back to the subsampled image, and dotted with its derivatives in each parameter.
+double Ssim_gradient::score(std::array<double, 3>& gradient)
+{
+    // Constants from the paper, L = 1.
+    constexpr double c1 = 0.01 * 0.01;
+    constexpr double c2 = 0.03 * 0.03;
+
+    // Subsampling is linear, so the derivatives are subsampled like the image.
+    const Ssim_reference& reference = ssim_reference;
+    const int width = reference.sub_width;
+    const int height = reference.sub_height;
+    std::array<std::vector<double>, 4> sub;
+    std::vector<double> row;
+    for (int c = 0; c < 4; ++c) {
+        Ssim_subsampler subsampler;
+        subsampler.init(g_dst_width, g_dst_height, reference.factor);
+        for (int y = 0; y < g_dst_height; ++y) {
+            if (subsampler.add_row(output[c].data() + static_cast<size_t>(y) * g_dst_width, 1.0, row)) {
+                sub[c].insert(sub[c].end(), row.begin(), row.end());
+            }
+        }
+    }
+
+    // Moments.
+    const std::vector<double>& image = sub[0];
+    std::vector<double> squares(image.size());
+    std::vector<double> products(image.size());
+    for (size_t i = 0; i < image.size(); ++i) {
+        squares[i] = image[i] * image[i];
+        products[i] = image[i] * reference.image[i];
+    }
+    std::vector<double> mu1;
+    std::vector<double> e11;
+    std::vector<double> e12;
+    filter(image, width, height, mu1);
+    filter(squares, width, height, e11);
+    filter(products, width, height, e12);
+
+    // The map and its derivatives in the moments.
+    const size_t map_size = mu1.size();
+    double sum = 0.0;
+    std::vector<double> d_mu1(map_size);
+    std::vector<double> d_e11(map_size);
+    std::vector<double> d_e12(map_size);
+    for (size_t i = 0; i < map_size; ++i) {
+        const double mu2 = reference.mu[i];
+        const double a1 = 2.0 * mu1[i] * mu2 + c1;
+        const double a2 = 2.0 * (e12[i] - mu1[i] * mu2) + c2;
+        const double b1 = mu1[i] * mu1[i] + mu2 * mu2 + c1;
+        const double b2 = e11[i] - mu1[i] * mu1[i] + reference.sigma_sq[i] + c2;
+        const double s = a1 * a2 / (b1 * b2);
+        sum += s;
+        d_mu1[i] = s * (2.0 * mu2 / a1 - 2.0 * mu2 / a2 - 2.0 * mu1[i] / b1 + 2.0 * mu1[i] / b2);
+        d_e11[i] = -s / b2;
+        d_e12[i] = 2.0 * s / a2;
+    }
+
+    // Back to the subsampled image, d SSIM / d x = (G' d_mu1 + 2 x G' d_e11 + y G' d_e12) / map size.
+    std::vector<double> g_mu1;
+    std::vector<double> g_e11;
+    std::vector<double> g_e12;
+    filter_transposed(d_mu1, width, height, g_mu1);
+    filter_transposed(d_e11, width, height, g_e11);
+    filter_transposed(d_e12, width, height, g_e12);
+    gradient.fill(0.0);
+    for (size_t i = 0; i < image.size(); ++i) {
+        const double d = g_mu1[i] + 2.0 * image[i] * g_e11[i] + reference.image[i] * g_e12[i];
+        for (int p = 0; p < 3; ++p) {
+            gradient[p] += d * sub[p + 1][i];
+        }
+    }
+    for (auto& g : gradient) {
+        g /= static_cast<double>(map_size);
+    }
+    return sum / static_cast<double>(map_size);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common.h"
+#include "kernel_functions.h"
+#include "ssim.h"
+
+// SSIM of orthogonal resampling on the CPU and its gradient in blur, p1 and p2, for --optimizer lbfgsb.
+
+// Normalized weights of one axis and their derivatives in blur, p1 and p2, in double.
+struct Gradient_table
+{
+    // Taps per output sample, 2 * bound.
+    int taps;
+
+    // First source index of each output sample, unclamped.
+    std::vector<int> first;
+
+    std::vector<double> weights;
+    std::array<std::vector<double>, 3> derivatives;
+};
+
+// Same sample positions and weights as Create_weight_table.
+// Kernels are differentiated by central differences in double, see gradient.cpp.
+using Create_gradient_table = void (*)(Gradient_table& table, const Kernel_params& k, float scale, int src_size, int dst_size);
+
+// Resamples like Cpu_engine with the orthogonal filter and no approximations, y axis first like the shader,
+// and carries the derivatives of every sample through both passes, antiringing and the delinearization.
+// SSIM is then differentiated by a backward pass through the Gaussian moments of its map to the subsampled image.
+// An evaluation costs about 5 orthogonal passes more than SSIM alone.
+class Ssim_gradient
+{
+public:
+    void init(const uint8_t* scaled_image_data);
+
+    // Returns SSIM, gradient gets its derivatives in blur, p1 and p2.
+    double evaluate(const Kernel_params& params, std::array<double, 3>& gradient);
+private:
+    void pass_y(float ar);
+    void pass_x(float ar);
+    double score(std::array<double, 3>& gradient);
+    Create_gradient_table create_gradient_table;
+    float scale;
+
+    // Downscaling resamples in linear light, the last pass stores sRGB.
+    bool delinearize;
+
+    std::vector<float> image;
+    Gradient_table table_x;
+    Gradient_table table_y;
+
+    // Value and its 3 derivatives, after the y pass and after the x pass.
+    std::array<std::vector<float>, 4> intermediate;
+    std::array<std::vector<float>, 4> output;
+
+    Ssim_reference ssim_reference;
+};
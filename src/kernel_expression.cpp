@@ -0,0 +1,345 @@
+#include "kernel_expression.h"
+
+namespace
+{
+    struct Function
+    {
+        const char* name;
+        int op;
+        int arguments;
+    };
+
+    constexpr std::array<Function, 14> functions = { {
+        { "sin", EXPRESSION_OP_SIN, 1 },
+        { "cos", EXPRESSION_OP_COS, 1 },
+        { "exp", EXPRESSION_OP_EXP, 1 },
+        { "log", EXPRESSION_OP_LOG, 1 },
+        { "sqrt", EXPRESSION_OP_SQRT, 1 },
+        { "abs", EXPRESSION_OP_ABS, 1 },
+        { "cosh", EXPRESSION_OP_COSH, 1 },
+        { "sinc", EXPRESSION_OP_SINC, 1 },
+        { "jinc", EXPRESSION_OP_JINC, 1 },
+        { "i0", EXPRESSION_OP_BESSEL_I0, 1 },
+        { "j1", EXPRESSION_OP_BESSEL_J1, 1 },
+        { "pow", EXPRESSION_OP_POW, 2 },
+        { "min", EXPRESSION_OP_MIN, 2 },
+        { "max", EXPRESSION_OP_MAX, 2 },
+    } };
+
+    // Recursive descent over the grammar of compile_kernel_expression(), emitting code as it goes.
+    // Temporaries are allocated like a stack, operands are always the top ones, so few registers are needed.
+    class Compiler
+    {
+    public:
+        Compiler(const std::string& text, Kernel_expression& expression) : text(text), expression(expression) {}
+
+        void compile()
+        {
+            expression.text = text;
+            expression.code.clear();
+            expression.constants.clear();
+            expression.uses = {};
+            expression.result = parse_expression();
+            skip_space();
+            if (position < text.size()) {
+                fail("unexpected character");
+            }
+
+            // Temporaries were numbered from temporary, they go after the constants.
+            const int first_temporary = expression_inputs + static_cast<int>(expression.constants.size());
+            auto relocate = [&](uint8_t& r) {
+                if (r >= temporary) {
+                    r = static_cast<uint8_t>(r - temporary + first_temporary);
+                }
+            };
+            for (auto& instruction : expression.code) {
+                relocate(instruction.dst);
+                relocate(instruction.a);
+                relocate(instruction.b);
+            }
+            uint8_t result = static_cast<uint8_t>(expression.result);
+            relocate(result);
+            expression.result = result;
+            expression.registers = first_temporary + max_temporaries;
+            if (expression.registers > max_expression_registers) {
+                fail("expression too long");
+            }
+        }
+
+        std::string error;
+        size_t position = 0;
+    private:
+
+        // Temporaries are numbered from here while parsing, the count of constants isn't known until the end.
+        static constexpr int temporary = 128;
+
+        [[noreturn]] void fail(const char* message)
+        {
+            error = message;
+            throw std::runtime_error(message);
+        }
+
+        void skip_space()
+        {
+            while (position < text.size() && std::isspace(static_cast<unsigned char>(text[position]))) {
+                ++position;
+            }
+        }
+
+        bool accept(char c)
+        {
+            skip_space();
+            if (position < text.size() && text[position] == c) {
+                ++position;
+                return true;
+            }
+            return false;
+        }
+
+        int constant(float value)
+        {
+            for (size_t i = 0; i < expression.constants.size(); ++i) {
+                if (expression.constants[i] == value) {
+                    return expression_inputs + static_cast<int>(i);
+                }
+            }
+            if (expression_inputs + expression.constants.size() >= temporary) {
+                fail("too many constants");
+            }
+            expression.constants.push_back(value);
+            return expression_inputs + static_cast<int>(expression.constants.size()) - 1;
+        }
+
+        // Operands that are temporaries are released, the result takes the lowest free one.
+        int emit(int op, int a, int b = 0)
+        {
+            if (b >= temporary) {
+                --temporaries;
+            }
+            if (a >= temporary) {
+                --temporaries;
+            }
+            const int dst = temporary + temporaries++;
+            max_temporaries = std::max(max_temporaries, temporaries);
+            expression.code.push_back({ static_cast<uint8_t>(op), static_cast<uint8_t>(dst), static_cast<uint8_t>(a), static_cast<uint8_t>(b) });
+            return dst;
+        }
+
+        int parse_expression()
+        {
+            int a = parse_term();
+            while (true) {
+                if (accept('+')) {
+                    a = emit(EXPRESSION_OP_ADD, a, parse_term());
+                }
+                else if (accept('-')) {
+                    a = emit(EXPRESSION_OP_SUB, a, parse_term());
+                }
+                else {
+                    return a;
+                }
+            }
+        }
+
+        int parse_term()
+        {
+            int a = parse_unary();
+            while (true) {
+                if (accept('*')) {
+                    a = emit(EXPRESSION_OP_MUL, a, parse_unary());
+                }
+                else if (accept('/')) {
+                    a = emit(EXPRESSION_OP_DIV, a, parse_unary());
+                }
+                else {
+                    return a;
+                }
+            }
+        }
+
+        int parse_unary()
+        {
+            if (accept('-')) {
+                return emit(EXPRESSION_OP_NEG, parse_unary());
+            }
+            const int a = parse_primary();
+            if (accept('^')) {
+                return emit(EXPRESSION_OP_POW, a, parse_unary());
+            }
+            return a;
+        }
+
+        int parse_primary()
+        {
+            skip_space();
+            if (position >= text.size()) {
+                fail("unexpected end");
+            }
+            const char c = text[position];
+            if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+                size_t length;
+                const float value = std::stof(text.substr(position), &length);
+                position += length;
+                const int a = constant(value);
+
+                // Implicit multiplication binds tighter than anything else.
+                if (position < text.size() && (std::isalpha(static_cast<unsigned char>(text[position])) || text[position] == '(')) {
+                    return emit(EXPRESSION_OP_MUL, a, parse_primary());
+                }
+                return a;
+            }
+            if (accept('(')) {
+                const int a = parse_expression();
+                if (!accept(')')) {
+                    fail("missing )");
+                }
+                return a;
+            }
+            if (!std::isalpha(static_cast<unsigned char>(c))) {
+                fail("unexpected character");
+            }
+            const size_t begin = position;
+            while (position < text.size() && std::isalnum(static_cast<unsigned char>(text[position]))) {
+                ++position;
+            }
+            const std::string name = text.substr(begin, position - begin);
+            if (accept('(')) {
+                for (const auto& function : functions) {
+                    if (name == function.name) {
+                        const int a = parse_expression();
+                        int b = 0;
+                        if (function.arguments == 2) {
+                            if (!accept(',')) {
+                                fail("missing argument");
+                            }
+                            b = parse_expression();
+                        }
+                        if (!accept(')')) {
+                            fail("missing )");
+                        }
+                        return emit(function.op, a, b);
+                    }
+                }
+                position = begin;
+                fail("unknown function");
+            }
+            if (name == "x") {
+                return 0;
+            }
+            if (name == "r" || name == "radius") {
+                expression.uses[0] = true;
+                return 1;
+            }
+            if (name == "b" || name == "blur") {
+                expression.uses[1] = true;
+                return 2;
+            }
+            if (name == "p1") {
+                expression.uses[2] = true;
+                return 3;
+            }
+            if (name == "p2") {
+                expression.uses[3] = true;
+                return 4;
+            }
+            if (name == "pi") {
+                return constant(static_cast<float>(kernel_functions::m_pi));
+            }
+            position = begin;
+            fail("unknown name");
+        }
+
+        const std::string& text;
+        Kernel_expression& expression;
+        int temporaries = 0;
+        int max_temporaries = 0;
+    };
+
+    // Instance of the scalar op for every op index.
+    template <size_t... ops>
+    constexpr auto scalar_ops(std::index_sequence<ops...>)
+    {
+        return std::array<double (*)(double, double), sizeof...(ops)>{ expression_op<ops, double>... };
+    }
+}
+
+bool compile_kernel_expression(const std::string& text, Kernel_expression& expression, std::string& error)
+{
+    Compiler compiler(text, expression);
+    try {
+        compiler.compile();
+    }
+    catch (const std::exception&) {
+
+        // Only std::stof() throws without a message.
+        if (compiler.error.empty()) {
+            compiler.error = "invalid number";
+        }
+        error = compiler.error + " at " + std::to_string(compiler.position);
+        return false;
+    }
+    return true;
+}
+
+// Sample by sample in double, like the scalar kernels.
+static void evaluate_expression_scalar(const Expression_view& expression, const float* x, float* out, int n, const Kernel_plugin_params& params)
+{
+    static constexpr auto ops = scalar_ops(std::make_index_sequence<EXPRESSION_OP_COUNT>());
+    std::array<double, max_expression_registers> registers;
+    registers[1] = params.radius;
+    registers[2] = params.blur;
+    registers[3] = params.p1;
+    registers[4] = params.p2;
+    std::copy(expression.constants, expression.constants + expression.constant_count, registers.begin() + expression_inputs);
+    for (int i = 0; i < n; ++i) {
+        registers[0] = x[i];
+        for (int j = 0; j < expression.instruction_count; ++j) {
+            const Expression_instruction& instruction = expression.code[j];
+            registers[instruction.dst] = ops[instruction.op](registers[instruction.a], registers[instruction.b]);
+        }
+        out[i] = x[i] < params.radius ? static_cast<float>(registers[expression.result]) : 0.0f;
+    }
+}
+
+Evaluate_expression get_evaluate_expression(Isa isa, bool precise)
+{
+    switch (isa) {
+        case ISA_AVX512:
+            return get_evaluate_expression_avx512(precise);
+        case ISA_AVX2:
+            return get_evaluate_expression_avx2(precise);
+        default:
+            return evaluate_expression_scalar;
+    }
+}
+
+// The compiled expression, served as a kernel plugin.
+static Kernel_expression plugin_expression;
+static Expression_view plugin_view;
+static Evaluate_expression plugin_evaluate;
+static Kernel_plugin expression_plugin;
+
+static void evaluate_plugin(const float* x, float* out, int n, const Kernel_plugin_params* params, int cylindrical)
+{
+    plugin_evaluate(plugin_view, x, out, n, *params);
+}
+
+const Kernel_plugin* create_expression_plugin(const std::string& text, Isa isa, bool precise, std::string& error)
+{
+    if (!compile_kernel_expression(text, plugin_expression, error)) {
+        return nullptr;
+    }
+    plugin_view = { plugin_expression.code.data(), static_cast<int>(plugin_expression.code.size()), plugin_expression.constants.data(), static_cast<int>(plugin_expression.constants.size()), plugin_expression.result };
+    plugin_evaluate = get_evaluate_expression(isa, precise);
+
+    // Any value is valid, only the parameters it reads are printed.
+    constexpr std::array<const char*, 4> names = { "radius", "blur", "p1", "p2" };
+    expression_plugin.abi_version = KERNEL_PLUGIN_ABI_VERSION;
+    expression_plugin.name = plugin_expression.text.c_str();
+    for (int i = 0; i < 4; ++i) {
+        expression_plugin.parameters[i] = { plugin_expression.uses[i] ? names[i] : nullptr, -std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    }
+    expression_plugin.cylindrical = 1;
+    expression_plugin.evaluate = evaluate_plugin;
+    return &expression_plugin;
+}
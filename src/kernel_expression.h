@@ -0,0 +1,163 @@
+#pragma once
+
+#include "common.h"
+#include "cpu_features.h"
+#include "kernel_plugin.h"
+#include "kernel_functions.h"
+
+// Kernels defined by an arithmetic expression, see --kernel-expr.
+// The expression is compiled once into instructions over registers, which are run over blocks of samples,
+// each instruction over the whole block before the next one, so dispatch is paid once per block and not per sample.
+// Served to the resampler as a kernel plugin.
+
+// enum EXPRESSION_OP_
+enum Expression_op
+{
+    EXPRESSION_OP_ADD,
+    EXPRESSION_OP_SUB,
+    EXPRESSION_OP_MUL,
+    EXPRESSION_OP_DIV,
+    EXPRESSION_OP_NEG,
+    EXPRESSION_OP_POW,
+    EXPRESSION_OP_MIN,
+    EXPRESSION_OP_MAX,
+    EXPRESSION_OP_SIN,
+    EXPRESSION_OP_COS,
+    EXPRESSION_OP_EXP,
+    EXPRESSION_OP_LOG,
+    EXPRESSION_OP_SQRT,
+    EXPRESSION_OP_ABS,
+    EXPRESSION_OP_COSH,
+    EXPRESSION_OP_SINC,
+    EXPRESSION_OP_JINC,
+    EXPRESSION_OP_BESSEL_I0,
+    EXPRESSION_OP_BESSEL_J1,
+    EXPRESSION_OP_COUNT
+};
+
+// Registers are x, radius, blur, p1 and p2, then the constants, then temporaries.
+inline constexpr int expression_inputs = 5;
+inline constexpr int max_expression_registers = 64;
+
+// Samples an instruction is run over before the next one.
+inline constexpr int expression_block = 64;
+
+struct Expression_instruction
+{
+    uint8_t op;
+    uint8_t dst;
+    uint8_t a;
+    uint8_t b;
+};
+
+struct Kernel_expression
+{
+    std::string text;
+    std::vector<Expression_instruction> code;
+    std::vector<float> constants;
+    int registers;
+    int result;
+
+    // Which of radius, blur, p1 and p2 it reads.
+    std::array<bool, 4> uses;
+};
+
+// Grammar, with the usual precedence, ^ is right associative:
+// expression = term {("+" | "-") term}, term = unary {("*" | "/") unary}, unary = "-" unary | power,
+// power = primary ["^" unary], primary = number [primary] | name | function "(" expression {"," expression} ")" | "(" expression ")".
+// A number directly followed by a primary multiplies it, so "2r" is 2 * r, even in "x / 2r".
+// Names: x, r or radius, b or blur, p1, p2, pi.
+// Functions: sin, cos, exp, log, sqrt, abs, cosh, sinc (normalized, sin(pi x) / (pi x)), jinc (normalized, 2 J1(pi x) / (pi x)),
+// i0, j1 (Bessel functions), pow, min, max.
+// The kernel is 0 at and past the radius like the built-in ones.
+// Returns false and sets error if the text doesn't parse.
+bool compile_kernel_expression(const std::string& text, Kernel_expression& expression, std::string& error);
+
+// Result of op, T is double or a vector type of simd.h, unary ops ignore b.
+template <int op, typename T>
+inline T expression_op(T a, T b)
+{
+    using namespace kernel_functions;
+    if constexpr (op == EXPRESSION_OP_ADD) {
+        return a + b;
+    }
+    else if constexpr (op == EXPRESSION_OP_SUB) {
+        return a - b;
+    }
+    else if constexpr (op == EXPRESSION_OP_MUL) {
+        return a * b;
+    }
+    else if constexpr (op == EXPRESSION_OP_DIV) {
+        return a / b;
+    }
+    else if constexpr (op == EXPRESSION_OP_NEG) {
+        return -a;
+    }
+    else if constexpr (op == EXPRESSION_OP_POW) {
+        return simd_math::pow(a, b);
+    }
+    else if constexpr (op == EXPRESSION_OP_MIN) {
+        return select(a < b, a, b);
+    }
+    else if constexpr (op == EXPRESSION_OP_MAX) {
+        return select(a < b, b, a);
+    }
+    else if constexpr (op == EXPRESSION_OP_SIN) {
+        return simd_math::sin(a);
+    }
+    else if constexpr (op == EXPRESSION_OP_COS) {
+        return simd_math::cos(a);
+    }
+    else if constexpr (op == EXPRESSION_OP_EXP) {
+        return simd_math::exp(a);
+    }
+    else if constexpr (op == EXPRESSION_OP_LOG) {
+        return simd_math::log(a);
+    }
+    else if constexpr (op == EXPRESSION_OP_SQRT) {
+        return simd_math::sqrt(a);
+    }
+    else if constexpr (op == EXPRESSION_OP_ABS) {
+        return simd_math::abs(a);
+    }
+    else if constexpr (op == EXPRESSION_OP_COSH) {
+        return simd_math::cosh(a);
+    }
+    else if constexpr (op == EXPRESSION_OP_SINC) {
+        return select(is_zero(a), T(1.0), simd_math::sin(m_pi * a) / (m_pi * a));
+    }
+
+    // J1 and I0 are only approximated for x >= 0, J1(x) / x and I0 are even, J1 is odd.
+    else if constexpr (op == EXPRESSION_OP_JINC) {
+        const T x = m_pi * simd_math::abs(a);
+        return select(is_zero(a), T(1.0), 2.0 * bessel_J1(x) / x);
+    }
+    else if constexpr (op == EXPRESSION_OP_BESSEL_I0) {
+        return bessel_I0(simd_math::abs(a));
+    }
+    else {
+        return select(a < 0.0, -bessel_J1(-a), bessel_J1(a));
+    }
+}
+
+// Kernel_expression without its vectors, for the ISA translation units, see resample.h.
+struct Expression_view
+{
+    const Expression_instruction* code;
+    int instruction_count;
+    const float* constants;
+    int constant_count;
+    int result;
+};
+
+// out[i] = expression at x[i], n samples, out may be x.
+using Evaluate_expression = void (*)(const Expression_view& expression, const float* x, float* out, int n, const Kernel_plugin_params& params);
+
+// Vector ISAs evaluate with simd_math.h, precise picks its accuracy tier, the scalar one in double.
+Evaluate_expression get_evaluate_expression(Isa isa, bool precise);
+Evaluate_expression get_evaluate_expression_avx2(bool precise);
+Evaluate_expression get_evaluate_expression_avx512(bool precise);
+
+// Compiles text into a kernel plugin evaluated with the instructions of isa.
+// Returns nullptr and sets error if the text doesn't parse.
+const Kernel_plugin* create_expression_plugin(const std::string& text, Isa isa, bool precise, std::string& error);
@@ -0,0 +1,432 @@
+#pragma once
+
+#include "common.h"
+#include "simd_math.h"
+#include "global.h"
+
+// C++ port of kernel_functions.hlsli, used by the CPU resampler.
+// Keep both in sync.
+
+// enum KERNEL_FUNCTION_
+enum Kernel_function
+{
+    KERNEL_FUNCTION_LANCZOS,
+    KERNEL_FUNCTION_GINSENG,
+    KERNEL_FUNCTION_HAMMING,
+    KERNEL_FUNCTION_POW_COSINE,
+    KERNEL_FUNCTION_KAISER,
+    KERNEL_FUNCTION_POW_GARAMOND,
+    KERNEL_FUNCTION_POW_BLACKMAN,
+    KERNEL_FUNCTION_GNW,
+    KERNEL_FUNCTION_SAID,
+    KERNEL_FUNCTION_BICUBIC,
+    KERNEL_FUNCTION_FSR,
+    KERNEL_FUNCTION_BCSPLINE,
+
+    // g_kernel_plugin, CPU only.
+    KERNEL_FUNCTION_PLUGIN
+};
+
+// One point of the parameter space.
+struct Kernel_params
+{
+    int index;
+    float radius;
+    float blur;
+    float p1;
+    float p2;
+};
+
+namespace kernel_functions
+{
+    inline constexpr double m_pi = 3.14159265358979323846; // pi
+    inline constexpr double m_pi_2 = 1.57079632679489661923; // pi/2
+    inline constexpr double m_pi_4 = 0.785398163397448309616; // pi/4
+    inline constexpr double m_2_pi = 0.636619772367581343076; // 2/pi
+    inline constexpr double first_jinc_zero = 1.21966989126650445493;
+    inline constexpr double flt_eps = 1e-6;
+
+    // T is double or a vector type of simd.h, ternaries are select() so they work per lane.
+
+    template <typename T>
+    inline auto is_zero(T x)
+    {
+        return simd_math::abs(x) < flt_eps;
+    }
+
+    // Math functions
+    //
+
+    // Bessel function of the first kind, order one. J1.
+    template <typename T>
+    inline T bessel_J1(T x)
+    {
+        return select(x < 2.293116, x / 2.0 - x * x * x / 16.0 + x * x * x * x * x / 384.0 - x * x * x * x * x * x * x / 18432.0, simd_math::sqrt(m_2_pi / x) * (1.0 + 3.0 / 16.0 / (x * x) - 99.0 / 512.0 / (x * x * x * x)) * simd_math::cos(x, -3.0 * m_pi_4 + 3.0 / 8.0 / x - 21.0 / 128.0 / (x * x * x)));
+    }
+
+    // Modified Bessel function of the first kind, order zero. I0.
+    template <typename T>
+    inline T bessel_I0(T x)
+    {
+        return select(x < 4.970666, 1.0 + x * x / 4.0 + x * x * x * x / 64.0 + x * x * x * x * x * x / 2304.0 + x * x * x * x * x * x * x * x / 147456.0, 1.0 / simd_math::sqrt(2.0 * m_pi * x) * simd_math::exp(x));
+    }
+
+    //
+
+    // For all functions we assume x = abs(x).
+
+    // Base functions
+    //
+
+    // (b) is the kernel blur.
+
+    // Jinc
+    // Used for cylindrical resampling.
+    template <typename T>
+    inline T base_jinc(T x, double b)
+    {
+        return select(is_zero(x), T(m_pi_2 / b), bessel_J1(m_pi / b * x) / x);
+    }
+
+    // Sinc
+    // Used for orhogonal resampling.
+    template <typename T>
+    inline T base_sinc(T x, double b)
+    {
+        return select(is_zero(x), T(m_pi / b), simd_math::sin(m_pi / b * x) / x);
+    }
+
+    //
+
+    // Window functions
+    //
+
+    // (r) is the kernel radius.
+
+    template <typename T>
+    inline T sinc(T x, double r)
+    {
+        return select(is_zero(x), T(m_pi / r), simd_math::sin(m_pi / r * x) / x);
+    }
+
+    template <typename T>
+    inline T jinc(T x, double r)
+    {
+        return select(is_zero(x), T(m_pi_2 / first_jinc_zero / r), bessel_J1(m_pi / first_jinc_zero / r * x) / x);
+    }
+
+    template <typename T>
+    inline T hamming(T x, double r)
+    {
+        return 0.54 + 0.46 * simd_math::cos(m_pi / r * x);
+    }
+
+    template <typename T>
+    inline T power_of_cosine(T x, double r, double n)
+    {
+        return simd_math::pow(simd_math::cos(m_pi_2 / r * x), n);
+    }
+
+    template <typename T>
+    inline T kaiser(T x, double r, double beta)
+    {
+        return bessel_I0(beta * simd_math::sqrt(1.0 - x * x / (r * r)));
+    }
+
+    template <typename T>
+    inline T power_of_garamond(T x, double r, double n, double m)
+    {
+        return simd_math::pow(1.0 - simd_math::pow(x / r, n), m);
+    }
+
+    template <typename T>
+    inline T power_of_blackman(T x, double r, double a, double n)
+    {
+        return simd_math::pow((1.0 - a) / 2.0 + 0.5 * simd_math::cos(m_pi / r * x) + a / 2.0 * simd_math::cos(2.0 * m_pi / r * x), n);
+    }
+
+    template <typename T>
+    inline T generalized_normal_window(T x, double s, double n)
+    {
+        return simd_math::exp(-simd_math::pow(x / s, n));
+    }
+
+    template <typename T>
+    inline T said(T x, double eta, double chi)
+    {
+        return simd_math::cosh(std::sqrt(2.0 * eta) * m_pi * chi / (2.0 - eta) * x) * simd_math::exp(-m_pi * m_pi * chi * chi / ((2.0 - eta) * (2.0 - eta)) * x * x);
+    }
+
+    //
+
+    // Kernel functions
+    //
+
+    template <typename T>
+    inline T bicubic(T x, double a)
+    {
+        return select(x < 1.0, (a + 2.0) * x * x * x - (a + 3.0) * x * x + 1.0, a * x * x * x - 5.0 * a * x * x + 8.0 * a * x - 4.0 * a);
+    }
+
+    template <typename T>
+    inline T modified_fsr_kernel(T x, double b, double c)
+    {
+        return (1.0 / (2.0 * b - b * b) * (b / (c * c) * x * x - 1.0) * (b / (c * c) * x * x - 1.0) - (1.0 / (2.0 * b - b * b) - 1.0)) * (0.25 * x * x - 1.0) * (0.25 * x * x - 1.0);
+    }
+
+    template <typename T>
+    inline T bc_spline(T x, double b, double c)
+    {
+        return select(x < 1.0, (12.0 - 9.0 * b - 6.0 * c) * x * x * x + (-18.0 + 12.0 * b + 6.0 * c) * x * x + (6.0 - 2.0 * b), (-b - 6.0 * c) * x * x * x + (6.0 * b + 30.0 * c) * x * x + (-12.0 * b - 48.0 * c) * x + (8.0 * b + 24.0 * c));
+    }
+
+    //
+}
+
+// Kernel functors, one type per kernel index, same as get_weight() in ps_resample_ortho.hlsl (cylindrical = false)
+// and ps_resample_cyl.hlsl (cylindrical = true).
+// Code instantiated for a functor has no kernel switch in its tap loop, see select_kernel().
+// Expect abs(x).
+namespace kernels
+{
+    template <bool cylindrical, typename T>
+    inline T base(T x, double b)
+    {
+        if constexpr (cylindrical) {
+            return kernel_functions::base_jinc(x, b);
+        }
+        else {
+            return kernel_functions::base_sinc(x, b);
+        }
+    }
+
+    struct Kernel
+    {
+        Kernel() = default;
+        explicit Kernel(const Kernel_params& k) : radius(k.radius), blur(k.blur), p1(k.p1), p2(k.p2) {}
+        double radius;
+        double blur;
+        double p1;
+        double p2;
+
+        // Evaluates arrays of distances with evaluate() instead of one vector at a time.
+        static constexpr bool batched = false;
+    };
+
+    template <bool cylindrical>
+    struct Lanczos : Kernel
+    {
+        using Kernel::Kernel;
+        template <typename T>
+        T operator()(T x) const
+        {
+            // EWA Lanczos if cylindrical.
+            return select(x < radius, base<cylindrical>(x, blur) * (cylindrical ? kernel_functions::jinc(x, radius) : kernel_functions::sinc(x, radius)), T(0.0));
+        }
+    };
+
+    template <bool cylindrical>
+    struct Ginseng : Kernel
+    {
+        using Kernel::Kernel;
+        template <typename T>
+        T operator()(T x) const
+        {
+            // EWA Ginseng if cylindrical.
+            return select(x < radius, base<cylindrical>(x, blur) * (cylindrical ? kernel_functions::sinc(x, radius) : kernel_functions::jinc(x, radius)), T(0.0));
+        }
+    };
+
+    template <bool cylindrical>
+    struct Hamming : Kernel
+    {
+        using Kernel::Kernel;
+        template <typename T>
+        T operator()(T x) const
+        {
+            return select(x < radius, base<cylindrical>(x, blur) * kernel_functions::hamming(x, radius), T(0.0));
+        }
+    };
+
+    template <bool cylindrical>
+    struct Pow_cosine : Kernel
+    {
+        using Kernel::Kernel;
+        template <typename T>
+        T operator()(T x) const
+        {
+            return select(x < radius, base<cylindrical>(x, blur) * kernel_functions::power_of_cosine(x, radius, p1), T(0.0));
+        }
+    };
+
+    template <bool cylindrical>
+    struct Kaiser : Kernel
+    {
+        using Kernel::Kernel;
+        template <typename T>
+        T operator()(T x) const
+        {
+            return select(x < radius, base<cylindrical>(x, blur) * kernel_functions::kaiser(x, radius, p1), T(0.0));
+        }
+    };
+
+    template <bool cylindrical>
+    struct Pow_garamond : Kernel
+    {
+        using Kernel::Kernel;
+        template <typename T>
+        T operator()(T x) const
+        {
+            return select(x < radius, base<cylindrical>(x, blur) * kernel_functions::power_of_garamond(x, radius, p1, p2), T(0.0));
+        }
+    };
+
+    template <bool cylindrical>
+    struct Pow_blackman : Kernel
+    {
+        using Kernel::Kernel;
+        template <typename T>
+        T operator()(T x) const
+        {
+            return select(x < radius, base<cylindrical>(x, blur) * kernel_functions::power_of_blackman(x, radius, p1, p2), T(0.0));
+        }
+    };
+
+    template <bool cylindrical>
+    struct Gnw : Kernel
+    {
+        using Kernel::Kernel;
+        template <typename T>
+        T operator()(T x) const
+        {
+            return select(x < radius, base<cylindrical>(x, blur) * kernel_functions::generalized_normal_window(x, p1, p2), T(0.0));
+        }
+    };
+
+    template <bool cylindrical>
+    struct Said : Kernel
+    {
+        using Kernel::Kernel;
+        template <typename T>
+        T operator()(T x) const
+        {
+            return select(x < radius, base<cylindrical>(x, blur) * kernel_functions::said(x, p1, p2), T(0.0));
+        }
+    };
+
+    template <bool cylindrical>
+    struct Bicubic : Kernel
+    {
+        using Kernel::Kernel;
+        template <typename T>
+        T operator()(T x) const
+        {
+            return select(x < radius, kernel_functions::bicubic(x, p1), T(0.0));
+        }
+    };
+
+    template <bool cylindrical>
+    struct Fsr : Kernel
+    {
+        using Kernel::Kernel;
+        template <typename T>
+        T operator()(T x) const
+        {
+            return select(x < radius, kernel_functions::modified_fsr_kernel(x, p1, p2), T(0.0));
+        }
+    };
+
+    template <bool cylindrical>
+    struct Bc_spline : Kernel
+    {
+        using Kernel::Kernel;
+        template <typename T>
+        T operator()(T x) const
+        {
+            return select(x < radius, kernel_functions::bc_spline(x, p1, p2), T(0.0));
+        }
+    };
+
+    // Kernel of g_kernel_plugin.
+    template <bool cylindrical>
+    struct Plugin : Kernel
+    {
+        Plugin() = default;
+        explicit Plugin(const Kernel_params& k) : Kernel(k), params{ k.radius, k.blur, k.p1, k.p2 } {}
+        static constexpr bool batched = true;
+
+        // out may be x.
+        void evaluate(const float* x, float* out, int n) const
+        {
+            g_kernel_plugin->evaluate(x, out, n, &params, cylindrical);
+        }
+
+        // Calls the plugin directly rather than evaluate(), which the ISA translation units would instantiate and share.
+        template <typename T>
+        T operator()(T x) const
+        {
+            if constexpr (std::is_same_v<T, double>) {
+                float f = static_cast<float>(x);
+                g_kernel_plugin->evaluate(&f, &f, 1, &params, cylindrical);
+                return f;
+            }
+            else {
+                float lanes[T::lanes];
+                x.store(lanes);
+                g_kernel_plugin->evaluate(lanes, lanes, T::lanes, &params, cylindrical);
+                return T::load(lanes);
+            }
+        }
+
+        Kernel_plugin_params params;
+    };
+
+    // Black image.
+    template <bool cylindrical>
+    struct Zero : Kernel
+    {
+        using Kernel::Kernel;
+        template <typename T>
+        T operator()(T x) const
+        {
+            return T(0.0);
+        }
+    };
+}
+
+// Returns Instance<Kernel>::function for the functor of the kernel index.
+// This is the only kernel switch, the (filter x kernel) combination is picked once per sweep.
+template <bool cylindrical, template <typename> class Instance>
+auto select_kernel(int index)
+{
+    switch (index) {
+        case KERNEL_FUNCTION_LANCZOS:
+            return Instance<kernels::Lanczos<cylindrical>>::function;
+        case KERNEL_FUNCTION_GINSENG:
+            return Instance<kernels::Ginseng<cylindrical>>::function;
+        case KERNEL_FUNCTION_HAMMING:
+            return Instance<kernels::Hamming<cylindrical>>::function;
+        case KERNEL_FUNCTION_POW_COSINE:
+            return Instance<kernels::Pow_cosine<cylindrical>>::function;
+        case KERNEL_FUNCTION_KAISER:
+            return Instance<kernels::Kaiser<cylindrical>>::function;
+        case KERNEL_FUNCTION_POW_GARAMOND:
+            return Instance<kernels::Pow_garamond<cylindrical>>::function;
+        case KERNEL_FUNCTION_POW_BLACKMAN:
+            return Instance<kernels::Pow_blackman<cylindrical>>::function;
+        case KERNEL_FUNCTION_GNW:
+            return Instance<kernels::Gnw<cylindrical>>::function;
+        case KERNEL_FUNCTION_SAID:
+            return Instance<kernels::Said<cylindrical>>::function;
+        case KERNEL_FUNCTION_BICUBIC:
+            return Instance<kernels::Bicubic<cylindrical>>::function;
+        case KERNEL_FUNCTION_FSR:
+            return Instance<kernels::Fsr<cylindrical>>::function;
+        case KERNEL_FUNCTION_BCSPLINE:
+            return Instance<kernels::Bc_spline<cylindrical>>::function;
+        case KERNEL_FUNCTION_PLUGIN:
+            return Instance<kernels::Plugin<cylindrical>>::function;
+        default:
+            return Instance<kernels::Zero<cylindrical>>::function;
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+// ABI of kernel plugins, see --kernel-plugin.
+// A plugin is a DLL exporting get_kernel_plugin(), which returns a Kernel_plugin that lives as long as the DLL is loaded.
+// Only C types cross it, so plugins can be built with any compiler, this header is all they need.
+
+#define KERNEL_PLUGIN_ABI_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Meaning and valid range of a kernel parameter.
+// The kernel ignores the parameter if name is NULL.
+struct Kernel_plugin_parameter
+{
+    const char* name;
+    float lo;
+    float hi;
+};
+
+// One point of the parameter space.
+struct Kernel_plugin_params
+{
+    float radius;
+    float blur;
+    float p1;
+    float p2;
+};
+
+struct Kernel_plugin
+{
+    // KERNEL_PLUGIN_ABI_VERSION the plugin was built against.
+    int abi_version;
+
+    const char* name;
+
+    // Radius, blur, p1 and p2, the radius is always used.
+    struct Kernel_plugin_parameter parameters[4];
+
+    // Nonzero if the kernel has a cylindrical variant, else only the orthogonal filter can use it.
+    int cylindrical;
+
+    // Evaluates the kernel at n distances x >= 0 into out, which may be x itself.
+    // Distances at or past the radius have to give 0, weights are normalized afterwards.
+    // Called with large batches when weight tables are built and with a few lanes at a time otherwise,
+    // from several threads at once.
+    void (*evaluate)(const float* x, float* out, int n, const struct Kernel_plugin_params* params, int cylindrical);
+};
+
+typedef const struct Kernel_plugin* (*Get_kernel_plugin)(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,8 +1,11 @@
 #include "common.h"
 #include "cxxopts.hpp"
-#include "engine.h"
+#include "sweep.h"
+#include "cluster.h"
+#include "optimizer.h"
 #include "global.h"
 #include "config.h"
+#include "kernel_expression.h"
 
 #define STBI_FAILURE_USERMSG
 #define STB_IMAGE_IMPLEMENTATION
@@ -10,6 +13,128 @@
 
 #define FLT_EPS 1e-6f
 
+// 64-bit FNV-1a.
+static uint64_t fnv1a(const void* data, size_t size)
+{
+    const auto* p = static_cast<const uint8_t*>(data);
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ p[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+// Loads the DLL into g_kernel_plugin, it stays loaded until exit.
+static bool load_kernel_plugin(const std::string& path)
+{
+    const HMODULE module = LoadLibraryA(path.c_str());
+    if (!module) {
+        std::cerr << "ERROR: Couldn't load kernel plugin " << path << ".\n";
+        return false;
+    }
+    const auto get_kernel_plugin = reinterpret_cast<Get_kernel_plugin>(GetProcAddress(module, "get_kernel_plugin"));
+    if (!get_kernel_plugin) {
+        std::cerr << "ERROR: Kernel plugin " << path << " doesn't export get_kernel_plugin().\n";
+        return false;
+    }
+    g_kernel_plugin = get_kernel_plugin();
+    if (!g_kernel_plugin || g_kernel_plugin->abi_version != KERNEL_PLUGIN_ABI_VERSION || !g_kernel_plugin->evaluate) {
+        std::cerr << "ERROR: Kernel plugin " << path << " was built for another ABI version.\n";
+        return false;
+    }
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    std::vector<char> bytes(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(bytes.data(), bytes.size());
+    g_kernel_plugin_hash = fnv1a(bytes.data(), bytes.size());
+    return true;
+}
+
+// Points of an axis of the grid, hi is in if it's on the grid up to rounding.
+static int grid_points(float lo, float hi, float step)
+{
+    if (step <= 0.0f) {
+        return 1;
+    }
+    return static_cast<int>(std::floor((static_cast<double>(hi) - lo) / step + 1e-6)) + 1;
+}
+
+// Value of point i of an axis of the grid.
+static float grid_value(float lo, float step, int i)
+{
+    return static_cast<float>(lo + static_cast<double>(step) * i);
+}
+
+// Prints the points of shard outputs ranked by SSIM, for --merge.
+// A screened shard contributes only the points it re-scored exactly.
+static int merge_shards(const std::vector<std::string>& paths)
+{
+    std::vector<Kernel_params> params;
+    std::vector<double> results;
+    long long points = -1;
+    for (const auto& path : paths) {
+        std::ifstream file(path);
+        if (!file) {
+            std::cerr << "ERROR: Couldn't open " << path << ".\n";
+            return 1;
+        }
+        std::vector<std::string> lines;
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.rfind("Exact re-scoring", 0) == 0) {
+                lines.clear();
+            }
+            else if (line.rfind("R: ", 0) == 0) {
+                lines.push_back(line);
+            }
+            else if (line.rfind("Points: ", 0) == 0) {
+                points = std::stoll(line.substr(8));
+            }
+        }
+        for (const auto& line : lines) {
+            Kernel_params k = {};
+            double result;
+            if (std::sscanf(line.c_str(), "R: %f, B: %f, P1: %f, P2: %f, SSIM: %lf", &k.radius, &k.blur, &k.p1, &k.p2, &result) == 5) {
+                params.push_back(k);
+                results.push_back(result);
+            }
+        }
+    }
+
+    // Screened shards print fewer points than they evaluated, else all of them have to be here.
+    std::cout << "Merged " << results.size() << " points of " << paths.size() << " shards";
+    if (points >= 0) {
+        std::cout << ", the grid has " << points;
+    }
+    std::cout << "\n";
+
+    std::vector<size_t> order(results.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return results[a] > results[b]; });
+    std::cout << std::fixed;
+    for (size_t i : order) {
+        std::cout << std::setprecision(6);
+        std::cout << "R: " << params[i].radius;
+        std::cout << ", B: " << params[i].blur;
+        std::cout << ", P1: " << params[i].p1;
+        std::cout << ", P2: " << params[i].p2;
+        std::cout << std::setprecision(15);
+        std::cout << ", SSIM: " << results[i] << "\n";
+    }
+    if (!order.empty()) {
+        const size_t i = order[0];
+        std::cout << "The best: ";
+        std::cout << std::setprecision(6);
+        std::cout << "R: " << params[i].radius;
+        std::cout << ", B: " << params[i].blur;
+        std::cout << ", P1: " << params[i].p1;
+        std::cout << ", P2: " << params[i].p2;
+        std::cout << std::setprecision(15);
+        std::cout << ", SSIM: " << results[i] << "\n";
+    }
+    return 0;
+}
+
 struct Best_result
 {
     float radius;
@@ -29,6 +154,8 @@ int main(int argc, char** argv)
         ("scld-img", "Scaled image that will be rescaled to the reference image size", cxxopts::value<std::string>()->default_value(""))
         ("filter", "Filter index: 0 - Orthogonal (Sinc), 1 - Cylindrical (Jinc)", cxxopts::value<int>()->default_value("0"))
         ("kernel", "Kernel index: 0 - Lanczos, 1 - Ginseng, 2 - Hamming, 3 - PowCosine, 4 - Kaiser, 5 - PowGaramond, 6 - PowBlackman, 7 - GNW, 8 - Said, 9 - Bicubic, 10 - FSR, 11 - BCSpline", cxxopts::value<int>()->default_value("0"))
+        ("kernel-plugin", "Use the kernel of this DLL instead of --kernel, see kernel_plugin.h, CPU only", cxxopts::value<std::string>()->default_value(""))
+        ("kernel-expr", "Use this expression of x, radius, blur, p1 and p2 as the kernel, see kernel_expression.h, CPU only", cxxopts::value<std::string>()->default_value(""))
         ("radius-lo", "Kernel radius low value", cxxopts::value<float>()->default_value("2.0"))
         ("radius-hi", "Kernel radius high value", cxxopts::value<float>()->default_value("2.0"))
         ("radius-i", "Kernel radius increment", cxxopts::value<float>()->default_value("0.0"))
@@ -42,6 +169,31 @@ int main(int argc, char** argv)
         ("p2-hi", "Second free kernel parameter high value", cxxopts::value<float>()->default_value("0.0"))
         ("p2-i", "Second free kernel parameter increment", cxxopts::value<float>()->default_value("0.0"))
         ("ar", "Antiringing strenght [0.0, 1.0]", cxxopts::value<float>()->default_value("1.0"))
+        ("cpu", "Resample on the CPU instead of Direct3D 11")
+        ("batch", "Parameter sets resampled per traversal of the source, CPU only [1, 8]", cxxopts::value<int>()->default_value("8"))
+        ("fast-math", "Evaluate kernels with faster SIMD sin and pow, within ~6 ulp or 4.5e-7 relative instead of ~2, see --check-math, CPU only")
+        ("half", "Store the intermediate between the orthogonal passes as half floats, CPU only")
+        ("sparse-eps", "Drop the taps at the ends of the orthogonal weights not above this and renormalize, CPU only", cxxopts::value<float>()->default_value("0.0"))
+        ("box-reduce", "When downscaling, average blocks of the largest integer factor that divides the source before resampling, CPU only")
+        ("ssim-box", "Resample orthogonal candidates straight to the grid SSIM subsamples large images to, not when upscaling with antiringing, CPU only")
+        ("tile-threads", "Evaluate each orthogonal candidate in bands of rows on this many threads, CPU only", cxxopts::value<int>()->default_value("1"))
+        ("threads", "Evaluate points on this many threads, each with its own engine, 0 - one per core", cxxopts::value<int>()->default_value("1"))
+        ("screen-rank", "Screen cylindrical candidates with this many separable terms of their weights, 0 - off, CPU only [0, 8]", cxxopts::value<int>()->default_value("0"))
+        ("screen-top", "Screened candidates re-scored with the exact cylindrical resampler", cxxopts::value<int>()->default_value("8"))
+        ("shard", "Evaluate only shard k of N of the grid, k/N with 1 <= k <= N", cxxopts::value<std::string>()->default_value("1/1"))
+        ("refine", "Levels of refinement around the best points after the grid, 0 - off", cxxopts::value<int>()->default_value("0"))
+        ("refine-top", "Best points refined at each level", cxxopts::value<int>()->default_value("3"))
+        ("refine-div", "Each level divides the increments by this and evaluates within half of the previous increment around the best points", cxxopts::value<int>()->default_value("4"))
+        ("optimizer", "Search: grid, nelder-mead, pattern, bayes, cmaes, lbfgsb", cxxopts::value<std::string>()->default_value("grid"))
+        ("max-evals", "Evaluation budget of the optimizers", cxxopts::value<int>()->default_value("300"))
+        ("restarts", "Runs of local optimizers, the first from the center of the ranges, the others from random points, 0 - one per thread", cxxopts::value<int>()->default_value("0"))
+        ("x-tol", "Optimizers stop when their steps are below this fraction of the ranges", cxxopts::value<double>()->default_value("0.001"))
+        ("ssim-tol", "Optimizers stop when SSIM improves by less than this", cxxopts::value<double>()->default_value("1e-9"))
+        ("coordinator", "Hand out the grid to workers connecting to this Unix socket path or localhost TCP port", cxxopts::value<std::string>()->default_value(""))
+        ("worker", "Evaluate points for the coordinator at this Unix socket path or localhost TCP port, with the same images and settings, and exit", cxxopts::value<std::string>()->default_value(""))
+        ("chunk", "Batches handed to a worker at a time", cxxopts::value<int>()->default_value("4"))
+        ("merge", "Rank the points of these outputs of shards and exit, comma separated", cxxopts::value<std::vector<std::string>>())
+        ("check-math", "Print the accuracy of the SIMD math against the C++ library and of vector resampling against the scalar path, and exit, with an error if they're above the stated bounds")
         ;
 
     auto result = options.parse(argc, argv);
@@ -52,6 +204,28 @@ int main(int argc, char** argv)
         return 0;
     }
 
+    // Handle math check.
+    if (result.count("check-math")) {
+        if (detect_isa() == ISA_SCALAR) {
+            std::cerr << "ERROR: CPU has no AVX2 or AVX-512.\n";
+            return 1;
+        }
+        if (!check_math()) {
+            std::cerr << "ERROR: SIMD math is less accurate than stated.\n";
+            return 1;
+        }
+        if (!check_resample()) {
+            std::cerr << "ERROR: Vector resampling differs from the scalar path.\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    // Handle merge of shards.
+    if (result.count("merge")) {
+        return merge_shards(result["merge"].as<std::vector<std::string>>());
+    }
+
     // Read config.
     // We only do some basic value limits.
     config::reference_img = result["ref-img"].as<std::string>();
@@ -71,6 +245,104 @@ int main(int argc, char** argv)
     config::p2_hi = std::max(result["p2-hi"].as<float>(), config::p2_lo);
     config::p2_i = std::max(result["p2-i"].as<float>(), 0.0f);
     config::ar = std::clamp(result["ar"].as<float>(), 0.0f, 1.0f);
+    config::cpu = result.count("cpu");
+    config::batch = std::clamp(result["batch"].as<int>(), 1, max_batch);
+    config::fast_math = result.count("fast-math");
+    config::half = result.count("half");
+    config::sparse_eps = std::max(result["sparse-eps"].as<float>(), 0.0f);
+    config::box_reduce = result.count("box-reduce");
+    config::ssim_box = result.count("ssim-box");
+    config::tile_threads = std::max(result["tile-threads"].as<int>(), 1);
+    config::threads = result["threads"].as<int>() > 0 ? result["threads"].as<int>() : std::max<int>(std::thread::hardware_concurrency(), 1);
+    config::screen_rank = config::filter == 1 ? std::clamp(result["screen-rank"].as<int>(), 0, 8) : 0;
+    config::screen_top = std::max(result["screen-top"].as<int>(), 1);
+    config::coordinator = result["coordinator"].as<std::string>();
+    config::worker = result["worker"].as<std::string>();
+    config::chunk = std::max(result["chunk"].as<int>(), 1);
+    // All of it has to be consumed, so 1/4x isn't taken for 1/4.
+    const std::string shard = result["shard"].as<std::string>();
+    int shard_index;
+    int consumed = 0;
+    if (std::sscanf(shard.c_str(), "%d/%d%n", &shard_index, &config::shard_count, &consumed) != 2 || consumed != static_cast<int>(shard.size()) || shard_index < 1 || shard_index > config::shard_count) {
+        std::cerr << "ERROR: --shard has to be k/N with 1 <= k <= N.\n";
+        return 1;
+    }
+    config::shard_index = shard_index - 1;
+    config::refine = std::max(result["refine"].as<int>(), 0);
+    config::refine_top = std::max(result["refine-top"].as<int>(), 1);
+    config::refine_div = std::max(result["refine-div"].as<int>(), 2);
+    const std::string optimizer = result["optimizer"].as<std::string>();
+    const auto optimizer_name = std::find_if(optimizer_names.begin(), optimizer_names.end(), [&](const char* name) { return optimizer == name; });
+    if (optimizer_name == optimizer_names.end()) {
+        std::cerr << "ERROR: Unknown optimizer " << optimizer << ".\n";
+        return 1;
+    }
+    config::optimizer = static_cast<int>(optimizer_name - optimizer_names.begin());
+    config::max_evals = std::max(result["max-evals"].as<int>(), 1);
+    config::restarts = result["restarts"].as<int>() > 0 ? result["restarts"].as<int>() : config::threads;
+    config::x_tol = std::max(result["x-tol"].as<double>(), 0.0);
+    config::ssim_tol = std::max(result["ssim-tol"].as<double>(), 0.0);
+    if (config::optimizer != OPTIMIZER_GRID && (config::refine || config::shard_count > 1 || !config::coordinator.empty())) {
+        std::cerr << "ERROR: --optimizer can't be used with --refine, --shard or --coordinator.\n";
+        return 1;
+    }
+    if (config::refine && (config::shard_count > 1 || !config::coordinator.empty())) {
+        std::cerr << "ERROR: --refine can't be used with --shard or --coordinator.\n";
+        return 1;
+    }
+
+    // Load kernel plugin, an expression is compiled into one.
+    // The sweep has to stay inside of the ranges it declares.
+    const std::string kernel_plugin = result["kernel-plugin"].as<std::string>();
+    const std::string kernel_expr = result["kernel-expr"].as<std::string>();
+    if (!kernel_plugin.empty() || !kernel_expr.empty()) {
+        if (!config::cpu) {
+            std::cerr << "ERROR: Kernel plugins and expressions only run on the CPU, use --cpu.\n";
+            return 1;
+        }
+        if (!kernel_expr.empty()) {
+            std::string error;
+            g_kernel_plugin = create_expression_plugin(kernel_expr, detect_isa(), !config::fast_math, error);
+            if (!g_kernel_plugin) {
+                std::cerr << "ERROR: --kernel-expr: " << error << ".\n";
+                return 1;
+            }
+            g_kernel_plugin_hash = fnv1a(kernel_expr.data(), kernel_expr.size());
+        }
+        else if (!load_kernel_plugin(kernel_plugin)) {
+            return 1;
+        }
+        if (config::filter == 1 && !g_kernel_plugin->cylindrical) {
+            std::cerr << "ERROR: Kernel plugin " << g_kernel_plugin->name << " has no cylindrical variant.\n";
+            return 1;
+        }
+        const std::array<const char*, 4> names = { "radius", "blur", "p1", "p2" };
+        const std::array<float, 4> lo = { config::radius_lo, config::blur_lo, config::p1_lo, config::p2_lo };
+        const std::array<float, 4> hi = { config::radius_hi, config::blur_hi, config::p1_hi, config::p2_hi };
+        for (int i = 0; i < 4; ++i) {
+            const Kernel_plugin_parameter& parameter = g_kernel_plugin->parameters[i];
+            if (parameter.name && (lo[i] < parameter.lo || hi[i] > parameter.hi)) {
+                std::cerr << "ERROR: --" << names[i] << "-lo and --" << names[i] << "-hi have to be in [" << parameter.lo << ", " << parameter.hi << "] for " << g_kernel_plugin->name << ".\n";
+                return 1;
+            }
+        }
+
+        // Print what the parameters mean.
+        std::cout << "Kernel: " << g_kernel_plugin->name;
+        for (int i = 0; i < 4; ++i) {
+            if (g_kernel_plugin->parameters[i].name) {
+                std::cout << ", " << names[i] << ": " << g_kernel_plugin->parameters[i].name;
+            }
+        }
+        std::cout << "\n";
+        config::kernel = KERNEL_FUNCTION_PLUGIN;
+    }
+
+    // The gradient is of the orthogonal CPU resampler in blur, p1 and p2, built-in kernels are differentiated in double.
+    if (config::optimizer == OPTIMIZER_LBFGSB && (!config::cpu || config::filter != 0 || config::kernel == KERNEL_FUNCTION_PLUGIN || config::radius_hi > config::radius_lo)) {
+        std::cerr << "ERROR: --optimizer lbfgsb needs --cpu, the orthogonal filter, a built-in kernel and a fixed radius.\n";
+        return 1;
+    }
 
     // Load images.
     int n;
@@ -92,64 +364,208 @@ int main(int argc, char** argv)
         std::cerr << "ERROR: Reference image has to be 1 channel greyscale.\n";
         return 1;
     }
+    g_scaled_image_hash = fnv1a(scaled_image_data, static_cast<size_t>(g_src_width) * g_src_height);
+    g_reference_image_hash = fnv1a(g_reference_image_data, static_cast<size_t>(g_dst_width) * g_dst_height);
+
+    // Prepare engines.
+    Sweep sweep;
+    sweep.init(scaled_image_data);
 
-    // Prepare engine.
-    Engine engine;
-    engine.init();
-    engine.create_image(scaled_image_data);
-    engine.scale = static_cast<float>(g_dst_width) / static_cast<float>(g_src_width);
+    // Handle worker.
+    if (!config::worker.empty()) {
+        return run_worker(config::worker, sweep) ? 0 : 1;
+    }
 
     Best_result best_result = {};
     std::cout << std::fixed;
+
+    // All evaluated points, refinement starts from the best of them and skips them, only kept for --refine.
+    std::vector<Sweep_point> evaluated;
+
+    // Screened points and their approximate results.
+    bool screening = config::cpu && config::screen_rank > 0;
+    std::vector<Sweep_point> screened;
+
+    // Prints evaluated points.
+    auto print = [&](const Sweep_batch& batch) {
+        for (const auto& point : batch) {
+
+            // Print current result.
+            std::cout << std::setprecision(6);
+            std::cout << "R: " << point.params.radius;
+            std::cout << ", B: " << point.params.blur;
+            std::cout << ", P1: " << point.params.p1;
+            std::cout << ", P2: " << point.params.p2;
+            std::cout << std::setprecision(15);
+            std::cout << ", SSIM: " << point.result;
+            if (screening) {
+                std::cout << std::setprecision(6);
+                std::cout << ", rank " << config::screen_rank << " error: " << point.error;
+
+                // Only the screen_top best are re-scored, so the rest are dropped as they pile up.
+                screened.push_back(point);
+                if (screened.size() >= 2 * static_cast<size_t>(config::screen_top)) {
+                    std::nth_element(screened.begin(), screened.begin() + config::screen_top, screened.end(), [](const auto& a, const auto& b) { return a.result > b.result; });
+                    screened.resize(config::screen_top);
+                }
+            }
+            std::cout << "\n";
+            if (config::refine > 0) {
+                evaluated.push_back(point);
+            }
+
+            // Save the best result.
+            if (best_result.result < point.result) {
+                best_result.radius = point.params.radius;
+                best_result.blur = point.params.blur;
+                best_result.p1 = point.params.p1;
+                best_result.p2 = point.params.p2;
+                best_result.result = point.result;
+            }
+        }
+    };
+
+    std::vector<Sweep_batch> batches;
     
-    // Mian loop.
-    for (g_kernel_radius = config::radius_lo; g_kernel_radius < config::radius_hi + FLT_EPS; g_kernel_radius += config::radius_i) {
-        for (g_kernel_blur = config::blur_lo; g_kernel_blur < config::blur_hi + FLT_EPS; g_kernel_blur += config::blur_i) {
-            for (g_kernel_parameter1 = config::p1_lo; g_kernel_parameter1 < config::p1_hi + FLT_EPS; g_kernel_parameter1 += config::p1_i) {
-                for (g_kernel_parameter2 = config::p2_lo; g_kernel_parameter2 < config::p2_hi + FLT_EPS; g_kernel_parameter2 += config::p2_i) {
-                    engine.resample_image();
-                    auto result = engine.compare();
-
-                    // Print current result.
-                    std::cout << std::setprecision(6);
-                    std::cout << "R: " << g_kernel_radius;
-                    std::cout << ", B: " << g_kernel_blur;
-                    std::cout << ", P1: " << g_kernel_parameter1;
-                    std::cout << ", P2: " << g_kernel_parameter2;
-                    std::cout << std::setprecision(15);
-                    std::cout << ", SSIM: " << result << "\n";
-
-                    // Save the best result.
-                    if (best_result.result < result) {
-                        best_result.radius = g_kernel_radius;
-                        best_result.blur = g_kernel_blur;
-                        best_result.p1 = g_kernel_parameter1;
-                        best_result.p2 = g_kernel_parameter2;
-                        best_result.result = result;
-                    }
-                    
-                    // Prevent infinite loop.
-                    if (!config::p2_i) {
-                        break;
+    // Optimizers replace the grid.
+    if (config::optimizer != OPTIMIZER_GRID) {
+        Search_space space;
+        space.init();
+        Objective objective(sweep, space, print);
+        run_optimizer(objective);
+        std::cout << "Evaluations: " << objective.evaluations << "\n";
+    }
+    else {
+
+        // Mian loop.
+        // The grid is indexed by integers, so the points don't depend on accumulated rounding and every run enumerates them in the same order.
+        // A shard takes every shard_count-th point, which mixes radii so shards take about as long.
+        const int radius_n = grid_points(config::radius_lo, config::radius_hi, config::radius_i);
+        const int blur_n = grid_points(config::blur_lo, config::blur_hi, config::blur_i);
+        const int p1_n = grid_points(config::p1_lo, config::p1_hi, config::p1_i);
+        const int p2_n = grid_points(config::p2_lo, config::p2_hi, config::p2_i);
+        const long long points = static_cast<long long>(radius_n) * blur_n * p1_n * p2_n;
+        std::cout << "Points: " << points;
+        if (config::shard_count > 1) {
+            std::cout << ", shard " << config::shard_index + 1 << "/" << config::shard_count << ": " << (points + config::shard_count - 1 - config::shard_index) / config::shard_count;
+        }
+        std::cout << "\n";
+
+        // Points are generated as batches are asked for, so only the window in flight is held.
+        long long point = config::shard_index;
+        auto next_batch = [&](Sweep_batch& batch) {
+            batch.clear();
+            for (; point < points; point += config::shard_count) {
+                const int l = static_cast<int>(point % p2_n);
+                const int k = static_cast<int>(point / p2_n % p1_n);
+                const int j = static_cast<int>(point / p2_n / p1_n % blur_n);
+                const int i = static_cast<int>(point / p2_n / p1_n / blur_n);
+                const Kernel_params params = { config::kernel, grid_value(config::radius_lo, config::radius_i, i), grid_value(config::blur_lo, config::blur_i, j), grid_value(config::p1_lo, config::p1_i, k), grid_value(config::p2_lo, config::p2_i, l) };
+                if (!fits_sweep_batch(batch, params)) {
+                    break;
+                }
+                batch.push_back({ params, 0.0, 0.0 });
+            }
+            return !batch.empty();
+        };
+        if (!config::coordinator.empty()) {
+            if (!run_coordinator(config::coordinator, next_batch, config::chunk, print)) {
+                return 1;
+            }
+        }
+        else {
+            sweep.run(next_batch, print);
+        }
+
+        // Refine like a manual rerun with smaller increments around the best point, but around several of them at once.
+        // Every level divides the increments of the active axes by refine_div and evaluates the points within half of the previous increment
+        // around the refine_top best points so far, which covers the cells of the best points of the previous grid.
+        // Points are indexed on the grid of the level, which contains the previous ones, so none is evaluated twice.
+        std::array<double, 4> increments = { config::radius_i, config::blur_i, config::p1_i, config::p2_i };
+        const std::array<float, 4> lo = { config::radius_lo, config::blur_lo, config::p1_lo, config::p2_lo };
+        const std::array<float, 4> hi = { config::radius_hi, config::blur_hi, config::p1_hi, config::p2_hi };
+        for (int level = 1; level <= config::refine; ++level) {
+            std::array<int, 4> steps;
+            std::array<long long, 4> last;
+            for (int i = 0; i < 4; ++i) {
+                increments[i] /= config::refine_div;
+                steps[i] = increments[i] > 0.0 ? config::refine_div / 2 : 0;
+                last[i] = increments[i] > 0.0 ? static_cast<long long>(std::floor((hi[i] - lo[i]) / increments[i] + 1e-6)) : 0;
+            }
+            auto index = [&](const Kernel_params& params) {
+                const std::array<float, 4> values = { params.radius, params.blur, params.p1, params.p2 };
+                std::array<long long, 4> result = {};
+                for (int i = 0; i < 4; ++i) {
+                    if (increments[i] > 0.0) {
+                        result[i] = std::llround((values[i] - lo[i]) / increments[i]);
                     }
                 }
+                return result;
+            };
+            std::set<std::array<long long, 4>> known;
+            for (const auto& point : evaluated) {
+                known.insert(index(point.params));
+            }
 
-                // Prevent infinite loop.
-                if (!config::p1_i) {
-                    break;
+            std::vector<Sweep_point> best = evaluated;
+            const size_t top = std::min<size_t>(best.size(), config::refine_top);
+            std::partial_sort(best.begin(), best.begin() + top, best.end(), [](const auto& a, const auto& b) { return a.result > b.result; });
+            best.resize(top);
+            std::set<std::array<long long, 4>> points;
+            for (const auto& center : best) {
+                const std::array<long long, 4> c = index(center.params);
+                for (int i = -steps[0]; i <= steps[0]; ++i) {
+                    for (int j = -steps[1]; j <= steps[1]; ++j) {
+                        for (int k = -steps[2]; k <= steps[2]; ++k) {
+                            for (int l = -steps[3]; l <= steps[3]; ++l) {
+                                const std::array<long long, 4> point = { std::clamp(c[0] + i, 0ll, last[0]), std::clamp(c[1] + j, 0ll, last[1]), std::clamp(c[2] + k, 0ll, last[2]), std::clamp(c[3] + l, 0ll, last[3]) };
+                                if (!known.count(point)) {
+                                    points.insert(point);
+                                }
+                            }
+                        }
+                    }
                 }
             }
-            
-            // Prevent infinite loop.
-            if (!config::blur_i) {
-                break;
+
+            // The set is ordered by radius first, so batches fill up.
+            std::cout << std::setprecision(6);
+            std::cout << "Refinement " << level << "/" << config::refine << ": " << points.size() << " points";
+            std::cout << ", increments R: " << increments[0];
+            std::cout << ", B: " << increments[1];
+            std::cout << ", P1: " << increments[2];
+            std::cout << ", P2: " << increments[3] << "\n";
+            batches.clear();
+            for (const auto& point : points) {
+                std::array<float, 4> values;
+                for (int i = 0; i < 4; ++i) {
+                    values[i] = static_cast<float>(lo[i] + increments[i] * point[i]);
+                }
+                add_sweep_point(batches, { config::kernel, values[0], values[1], values[2], values[3] });
             }
+            sweep.run(batches, print);
         }
+    }
+
+    // Re-score the best screened points exactly, the best result is taken from these.
+    if (screening) {
+        std::sort(screened.begin(), screened.end(), [](const auto& a, const auto& b) { return a.result > b.result; });
+        screened.resize(std::min<size_t>(screened.size(), config::screen_top));
 
-        // Prevent infinite loop.
-        if (!config::radius_i) {
-            break;
+        // Batches never mix radii.
+        std::stable_sort(screened.begin(), screened.end(), [](const auto& a, const auto& b) { return a.params.radius < b.params.radius; });
+
+        std::cout << "Exact re-scoring of the top " << screened.size() << ":\n";
+        screening = false;
+        for (auto& engine : sweep.engines) {
+            engine.cpu_engine.screen_rank = 0;
+        }
+        best_result = {};
+        batches.clear();
+        for (const auto& point : screened) {
+            add_sweep_point(batches, point.params);
         }
+        sweep.run(batches, print);
     }
 
     // Print the best result.
@@ -162,6 +578,34 @@ int main(int argc, char** argv)
     std::cout << std::setprecision(15);
     std::cout << ", SSIM: " << best_result.result << "\n";
 
+    // Report how evenly the threads were loaded, the busiest one against the average and how long they waited for work.
+    if (config::threads > 1 && sweep.wall_seconds > 0.0) {
+        const double busiest = *std::max_element(sweep.busy_seconds.begin(), sweep.busy_seconds.end());
+        const double mean = std::accumulate(sweep.busy_seconds.begin(), sweep.busy_seconds.end(), 0.0) / config::threads;
+        std::cout << std::setprecision(3);
+        std::cout << "Threads: " << config::threads;
+        std::cout << ", busiest: " << busiest << " s";
+        std::cout << ", mean: " << mean << " s";
+        std::cout << ", load imbalance: " << (mean > 0.0 ? (busiest / mean - 1.0) * 100.0 : 0.0) << "%";
+        std::cout << ", idle: " << (sweep.wall_seconds > 0.0 ? (1.0 - mean / sweep.wall_seconds) * 100.0 : 0.0) << "%";
+        std::cout << ", steals: " << sweep.steals << "\n";
+        std::cout << std::setprecision(15);
+    }
+
+    // Report the error of the approximations at the best point.
+    if (config::cpu && (config::half || config::sparse_eps > 0.0f || config::box_reduce || config::ssim_box)) {
+        const Kernel_params best = { config::kernel, best_result.radius, best_result.blur, best_result.p1, best_result.p2 };
+        Cpu_engine& cpu_engine = sweep.engines[0].cpu_engine;
+        cpu_engine.half_intermediate = false;
+        cpu_engine.sparse_epsilon = 0.0f;
+        cpu_engine.box_reduce = false;
+        cpu_engine.ssim_box = false;
+        cpu_engine.resample_images(&best, 1);
+        const double result = cpu_engine.compare(0);
+        std::cout << "Exact SSIM: " << result;
+        std::cout << ", approximate - exact: " << best_result.result - result << "\n";
+    }
+
     stbi_image_free(scaled_image_data);
     stbi_image_free(g_reference_image_data);
     return 0;
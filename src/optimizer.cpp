@@ -0,0 +1,313 @@
+#include "optimizer.h"
+#include "global.h"
+#include "config.h"
+
+void Search_space::init()
+{
+    lo = { config::radius_lo, config::blur_lo, config::p1_lo, config::p2_lo };
+    hi = { config::radius_hi, config::blur_hi, config::p1_hi, config::p2_hi };
+    axes.clear();
+    for (int i = 0; i < 4; ++i) {
+        if (hi[i] > lo[i]) {
+            axes.push_back(i);
+        }
+    }
+}
+
+Kernel_params Search_space::to_params(const std::vector<double>& x) const
+{
+    std::array<float, 4> values = lo;
+    for (size_t i = 0; i < axes.size(); ++i) {
+        const int axis = axes[i];
+        values[axis] = std::clamp(static_cast<float>(lo[axis] + std::clamp(x[i], 0.0, 1.0) * (static_cast<double>(hi[axis]) - lo[axis])), lo[axis], hi[axis]);
+    }
+    return { config::kernel, values[0], values[1], values[2], values[3] };
+}
+
+std::vector<double> Search_space::from_params(const Kernel_params& params) const
+{
+    const std::array<float, 4> values = { params.radius, params.blur, params.p1, params.p2 };
+    std::vector<double> x(axes.size());
+    for (size_t i = 0; i < axes.size(); ++i) {
+        const int axis = axes[i];
+        x[i] = (static_cast<double>(values[axis]) - lo[axis]) / (static_cast<double>(hi[axis]) - lo[axis]);
+    }
+    return x;
+}
+
+Objective::Objective(Sweep& sweep, const Search_space& space, const std::function<void(const Sweep_batch&)>& done) : sweep(sweep), space(space), budget(config::max_evals), done(done) {}
+
+// Batches keep the order of points.
+std::vector<Sweep_batch> Objective::create_batches(const std::vector<std::vector<double>>& points) const
+{
+    std::vector<Sweep_batch> batches;
+    for (const auto& point : points) {
+        add_sweep_point(batches, space.to_params(point));
+    }
+    return batches;
+}
+
+std::vector<double> Objective::evaluate(const std::vector<std::vector<double>>& points)
+{
+    std::vector<Sweep_batch> batches = create_batches(points);
+    std::vector<double> results;
+    sweep.run(batches, [&](const Sweep_batch& batch) {
+        std::lock_guard lock(mutex);
+        done(batch);
+        for (const auto& point : batch) {
+            results.push_back(point.result);
+        }
+    });
+    evaluations += static_cast<int>(points.size());
+    return results;
+}
+
+std::vector<double> Objective::evaluate(Sweep_engine& engine, const std::vector<std::vector<double>>& points)
+{
+    std::vector<Sweep_batch> batches = create_batches(points);
+    std::vector<double> results;
+    for (auto& batch : batches) {
+        sweep.evaluate(engine, batch);
+        std::lock_guard lock(mutex);
+        done(batch);
+        for (const auto& point : batch) {
+            results.push_back(point.result);
+        }
+    }
+    evaluations += static_cast<int>(points.size());
+    return results;
+}
+
+double Objective::evaluate_gradient(Sweep_engine& engine, const std::vector<double>& point, std::vector<double>& gradient)
+{
+    const Kernel_params params = space.to_params(point);
+    std::array<double, 3> derivatives;
+    const double result = engine.gradient.evaluate(params, derivatives);
+
+    // Axes of the unit cube are scaled by the range, axis 0 is the radius.
+    gradient.resize(space.axes.size());
+    for (size_t i = 0; i < space.axes.size(); ++i) {
+        const int axis = space.axes[i];
+        gradient[i] = derivatives[axis - 1] * (static_cast<double>(space.hi[axis]) - space.lo[axis]);
+    }
+    const Sweep_batch batch = { { params, result, 0.0 } };
+    {
+        std::lock_guard lock(mutex);
+        done(batch);
+    }
+    ++evaluations;
+    return result;
+}
+
+void run_optimizer(Objective& objective)
+{
+    switch (config::optimizer) {
+        case OPTIMIZER_NELDER_MEAD:
+            run_nelder_mead(objective);
+            break;
+        case OPTIMIZER_PATTERN:
+            run_pattern_search(objective);
+            break;
+        case OPTIMIZER_BAYES:
+            run_bayes(objective);
+            break;
+        case OPTIMIZER_CMAES:
+            run_cmaes(objective);
+            break;
+        case OPTIMIZER_LBFGSB:
+            run_lbfgsb(objective);
+            break;
+    }
+}
+
+// Runs config::restarts runs of a local optimizer, as many at once as there are engines, each on one of them.
+// The first starts from the center of the box, the others from random points, seeded by their index so runs repeat.
+void run_restarts(Objective& objective, const std::function<void(Sweep_engine& engine, std::vector<double> start)>& run)
+{
+    // A single point needs only one run.
+    const int dims = static_cast<int>(objective.space.axes.size());
+    const int restarts = dims > 0 ? config::restarts : 1;
+    std::atomic<int> next = 0;
+    auto work = [&](Sweep_engine& engine) {
+        for (int restart = next++; restart < restarts && !objective.exhausted(); restart = next++) {
+            std::vector<double> start(dims, 0.5);
+            if (restart > 0) {
+                std::mt19937 generator(restart);
+                std::uniform_real_distribution<double> distribution(0.0, 1.0);
+                for (auto& x : start) {
+                    x = distribution(generator);
+                }
+            }
+            run(engine, start);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < std::min<int>(restarts, objective.sweep.engines.size()); ++i) {
+        threads.emplace_back(work, std::ref(objective.sweep.engines[i]));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// Minimizes -SSIM with the standard coefficients, points outside of the box are clamped into it.
+// Stops when the simplex is smaller than x_tol along every free axis or its SSIM spread is below ssim_tol.
+void run_nelder_mead(Objective& objective)
+{
+    const int dims = static_cast<int>(objective.space.axes.size());
+    run_restarts(objective, [&](Sweep_engine& engine, std::vector<double> start) {
+        auto clamp = [](std::vector<double> x) {
+            for (auto& value : x) {
+                value = std::clamp(value, 0.0, 1.0);
+            }
+            return x;
+        };
+        auto evaluate = [&](const std::vector<std::vector<double>>& points) {
+            std::vector<double> f = objective.evaluate(engine, points);
+            for (auto& value : f) {
+                value = -value;
+            }
+            return f;
+        };
+
+        // Simplex of steps along each axis, away from the nearest bound.
+        std::vector<std::vector<double>> x(dims + 1);
+        std::vector<double> f(dims + 1);
+        auto create_simplex = [&](const std::vector<double>& origin, double f_origin, double step) {
+            std::fill(x.begin(), x.end(), origin);
+            std::vector<std::vector<double>> points;
+            for (int i = 0; i < dims; ++i) {
+                x[i + 1][i] += origin[i] + step <= 1.0 ? step : -step;
+                points.push_back(x[i + 1]);
+            }
+            const std::vector<double> f_points = evaluate(points);
+            f[0] = f_origin;
+            std::copy(f_points.begin(), f_points.end(), f.begin() + 1);
+        };
+        create_simplex(start, evaluate({ start })[0], 0.25);
+
+        // Clamping can flatten the simplex against a bound, so a converged one is rebuilt around its best point,
+        // until that doesn't improve anymore.
+        double f_simplex = f[0];
+        std::vector<int> order(dims + 1);
+        while (dims > 0 && !objective.exhausted()) {
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(), [&](int a, int b) { return f[a] < f[b]; });
+            const int best = order[0];
+            const int worst = order[dims];
+            const int second_worst = order[dims - 1];
+            double size = 0.0;
+            for (int i = 0; i <= dims; ++i) {
+                for (int j = 0; j < dims; ++j) {
+                    size = std::max(size, std::abs(x[i][j] - x[best][j]));
+                }
+            }
+            if (size < config::x_tol || f[worst] - f[best] < config::ssim_tol) {
+                if (f[best] > f_simplex - config::ssim_tol) {
+                    break;
+                }
+                f_simplex = f[best];
+                create_simplex(std::vector<double>(x[best]), f[best], std::max(4.0 * size, 0.05));
+                continue;
+            }
+
+            // Centroid of all but the worst point.
+            std::vector<double> centroid(dims, 0.0);
+            for (int i = 0; i <= dims; ++i) {
+                if (i != worst) {
+                    for (int j = 0; j < dims; ++j) {
+                        centroid[j] += x[i][j] / dims;
+                    }
+                }
+            }
+            auto along = [&](double t) {
+                std::vector<double> point(dims);
+                for (int j = 0; j < dims; ++j) {
+                    point[j] = centroid[j] + t * (x[worst][j] - centroid[j]);
+                }
+                return clamp(point);
+            };
+
+            const std::vector<double> reflected = along(-1.0);
+            const double f_reflected = evaluate({ reflected })[0];
+            if (f_reflected < f[best]) {
+                const std::vector<double> expanded = along(-2.0);
+                const double f_expanded = evaluate({ expanded })[0];
+                if (f_expanded < f_reflected) {
+                    x[worst] = expanded;
+                    f[worst] = f_expanded;
+                }
+                else {
+                    x[worst] = reflected;
+                    f[worst] = f_reflected;
+                }
+            }
+            else if (f_reflected < f[second_worst]) {
+                x[worst] = reflected;
+                f[worst] = f_reflected;
+            }
+            else {
+
+                // Contract outside if the reflection is at least better than the worst point, else inside.
+                const bool outside = f_reflected < f[worst];
+                const std::vector<double> contracted = along(outside ? -0.5 : 0.5);
+                const double f_contracted = evaluate({ contracted })[0];
+                if (f_contracted < (outside ? f_reflected : f[worst])) {
+                    x[worst] = contracted;
+                    f[worst] = f_contracted;
+                }
+                else {
+
+                    // Shrink towards the best point.
+                    std::vector<std::vector<double>> shrunk;
+                    for (int i = 0; i <= dims; ++i) {
+                        if (i != best) {
+                            for (int j = 0; j < dims; ++j) {
+                                x[i][j] = x[best][j] + 0.5 * (x[i][j] - x[best][j]);
+                            }
+                            shrunk.push_back(x[i]);
+                        }
+                    }
+                    const std::vector<double> f_shrunk = evaluate(shrunk);
+                    for (int i = 0, k = 0; i <= dims; ++i) {
+                        if (i != best) {
+                            f[i] = f_shrunk[k++];
+                        }
+                    }
+                }
+            }
+        }
+    });
+}
+
+// Polls a step along each free axis in both directions, moves to the best poll if it improves by more than ssim_tol,
+// else halves the step, until it's below x_tol. The polls of a step are resampled together.
+void run_pattern_search(Objective& objective)
+{
+    const int dims = static_cast<int>(objective.space.axes.size());
+    run_restarts(objective, [&](Sweep_engine& engine, std::vector<double> x) {
+        double f = objective.evaluate(engine, { x })[0];
+        double step = 0.25;
+        while (dims > 0 && step >= config::x_tol && !objective.exhausted()) {
+            std::vector<std::vector<double>> polls;
+            for (int i = 0; i < dims; ++i) {
+                for (double direction : { -1.0, 1.0 }) {
+                    std::vector<double> poll = x;
+                    poll[i] = std::clamp(poll[i] + direction * step, 0.0, 1.0);
+                    if (poll[i] != x[i]) {
+                        polls.push_back(poll);
+                    }
+                }
+            }
+            const std::vector<double> f_polls = objective.evaluate(engine, polls);
+            const auto best = std::max_element(f_polls.begin(), f_polls.end());
+            if (best != f_polls.end() && *best > f + config::ssim_tol) {
+                x = polls[best - f_polls.begin()];
+                f = *best;
+            }
+            else {
+                step *= 0.5;
+            }
+        }
+    });
+}
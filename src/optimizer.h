@@ -0,0 +1,84 @@
+#pragma once
+
+#include "common.h"
+#include "sweep.h"
+
+// Searches of the parameter space that replace the grid, see --optimizer.
+
+// enum OPTIMIZER_
+enum Optimizer
+{
+    OPTIMIZER_GRID,
+    OPTIMIZER_NELDER_MEAD,
+    OPTIMIZER_PATTERN,
+    OPTIMIZER_BAYES,
+    OPTIMIZER_CMAES,
+    OPTIMIZER_LBFGSB
+};
+
+// Names for --optimizer, in the order of Optimizer.
+inline constexpr std::array<const char*, 6> optimizer_names = { "grid", "nelder-mead", "pattern", "bayes", "cmaes", "lbfgsb" };
+
+// Box of the -lo and -hi options, an axis with lo == hi is fixed at lo.
+// Optimizers see only the free axes, scaled to [0, 1].
+struct Search_space
+{
+    std::array<float, 4> lo;
+    std::array<float, 4> hi;
+
+    // Indices of the free axes, 0 radius, 1 blur, 2 p1 and 3 p2.
+    std::vector<int> axes;
+
+    void init();
+    Kernel_params to_params(const std::vector<double>& x) const;
+    std::vector<double> from_params(const Kernel_params& params) const;
+};
+
+// Evaluates points for the optimizers, passing each to done() as it's evaluated, and counts them against a budget.
+// done() is never called concurrently.
+class Objective
+{
+public:
+    Objective(Sweep& sweep, const Search_space& space, const std::function<void(const Sweep_batch&)>& done);
+
+    // SSIM of points of the unit cube, clamped into it, evaluated on all threads.
+    std::vector<double> evaluate(const std::vector<std::vector<double>>& points);
+
+    // Same on one engine, for optimizers that run on several threads of their own.
+    std::vector<double> evaluate(Sweep_engine& engine, const std::vector<std::vector<double>>& points);
+
+    // SSIM of a point of the unit cube on one engine's Ssim_gradient, gradient gets its derivatives along the free axes.
+    // Radius has to be fixed.
+    double evaluate_gradient(Sweep_engine& engine, const std::vector<double>& point, std::vector<double>& gradient);
+
+    bool exhausted() const { return evaluations >= budget; }
+
+    Sweep& sweep;
+    const Search_space& space;
+    std::atomic<int> evaluations = 0;
+    int budget;
+private:
+    std::vector<Sweep_batch> create_batches(const std::vector<std::vector<double>>& points) const;
+    std::function<void(const Sweep_batch&)> done;
+    std::mutex mutex;
+};
+
+// Runs config::optimizer until it converges or config::max_evals are used up.
+void run_optimizer(Objective& objective);
+
+// config::restarts runs of a local optimizer on the engines, from the center of the box and from random points, see optimizer.cpp.
+void run_restarts(Objective& objective, const std::function<void(Sweep_engine& engine, std::vector<double> start)>& run);
+
+// Bounded Nelder-Mead and compass pattern search from the center of the box and from random points,
+// config::restarts of them on their own threads, see optimizer.cpp.
+void run_nelder_mead(Objective& objective);
+void run_pattern_search(Objective& objective);
+
+// Gaussian process surrogate with expected improvement, batches of one point per thread, see optimizer_bayes.cpp.
+void run_bayes(Objective& objective);
+
+// CMA-ES with a population of a multiple of the threads, see optimizer_cmaes.cpp.
+void run_cmaes(Objective& objective);
+
+// L-BFGS-B on the analytic gradient of SSIM, restarted like Nelder-Mead, see optimizer_lbfgsb.cpp.
+void run_lbfgsb(Objective& objective);
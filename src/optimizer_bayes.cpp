@@ -0,0 +1,257 @@
+#include "optimizer.h"
+#include "config.h"
+
+namespace
+{
+    // Gaussian process regression with a Matern 5/2 kernel of a length scale per axis, on results normalized to zero mean and unit variance.
+    class Gaussian_process
+    {
+    public:
+
+        // Picks the length scales of the largest marginal likelihood and conditions on the points.
+        void fit(const std::vector<std::vector<double>>& points, const std::vector<double>& results)
+        {
+            x = points;
+            mean = std::accumulate(results.begin(), results.end(), 0.0) / results.size();
+            double variance = 0.0;
+            for (double result : results) {
+                variance += (result - mean) * (result - mean);
+            }
+            scale = std::max(std::sqrt(variance / results.size()), 1e-12);
+            y.clear();
+            for (double result : results) {
+                y.push_back((result - mean) / scale);
+            }
+
+            // Same scale on all axes first, then each axis on its own.
+            const size_t dims = x[0].size();
+            double best = -std::numeric_limits<double>::infinity();
+            std::vector<double> best_lengths;
+            for (double length : { 0.05, 0.1, 0.2, 0.4, 0.8, 1.6 }) {
+                lengths.assign(dims, length);
+                const double likelihood = condition();
+                if (likelihood > best) {
+                    best = likelihood;
+                    best_lengths = lengths;
+                }
+            }
+            for (int round = 0; round < 3; ++round) {
+                for (size_t i = 0; i < dims; ++i) {
+                    for (double factor : { 0.5, 0.7, 1.4, 2.0 }) {
+                        lengths = best_lengths;
+                        lengths[i] = std::clamp(lengths[i] * factor, 0.01, 10.0);
+                        const double likelihood = condition();
+                        if (likelihood > best) {
+                            best = likelihood;
+                            best_lengths = lengths;
+                        }
+                    }
+                }
+            }
+            lengths = best_lengths;
+            condition();
+        }
+
+        // Adds a point with the result the model predicts there, so the next pick of a batch goes elsewhere.
+        void add_believed(const std::vector<double>& point)
+        {
+            double believed;
+            double deviation;
+            predict(point, believed, deviation);
+            x.push_back(point);
+            y.push_back((believed - mean) / scale);
+            condition();
+        }
+
+        // Mean and standard deviation of the result at point.
+        void predict(const std::vector<double>& point, double& result, double& deviation) const
+        {
+            const size_t n = x.size();
+            std::vector<double> v(n);
+            double m = 0.0;
+            for (size_t i = 0; i < n; ++i) {
+                v[i] = kernel(point, x[i]);
+                m += v[i] * alpha[i];
+            }
+
+            // Variance is 1 - |inverse(L) k|^2.
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t j = 0; j < i; ++j) {
+                    v[i] -= l[i * n + j] * v[j];
+                }
+                v[i] /= l[i * n + i];
+            }
+            double variance = 1.0;
+            for (double value : v) {
+                variance -= value * value;
+            }
+            result = mean + scale * m;
+            deviation = scale * std::sqrt(std::max(variance, 1e-12));
+        }
+
+    private:
+        double kernel(const std::vector<double>& a, const std::vector<double>& b) const
+        {
+            double r2 = 0.0;
+            for (size_t i = 0; i < a.size(); ++i) {
+                const double d = (a[i] - b[i]) / lengths[i];
+                r2 += d * d;
+            }
+            const double r = std::sqrt(5.0 * r2);
+            return (1.0 + r + r * r / 3.0) * std::exp(-r);
+        }
+
+        // Cholesky factor of the covariance and its solution for y, returns the log marginal likelihood without the constant.
+        double condition()
+        {
+            // Results are deterministic, the nugget only keeps the factorization stable.
+            constexpr double nugget = 1e-6;
+            const size_t n = x.size();
+            l.assign(n * n, 0.0);
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t j = 0; j <= i; ++j) {
+                    double sum = kernel(x[i], x[j]) + (i == j ? nugget : 0.0);
+                    for (size_t k = 0; k < j; ++k) {
+                        sum -= l[i * n + k] * l[j * n + k];
+                    }
+                    if (i == j) {
+                        l[i * n + i] = std::sqrt(std::max(sum, 1e-12));
+                    }
+                    else {
+                        l[i * n + j] = sum / l[j * n + j];
+                    }
+                }
+            }
+            alpha = y;
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t j = 0; j < i; ++j) {
+                    alpha[i] -= l[i * n + j] * alpha[j];
+                }
+                alpha[i] /= l[i * n + i];
+            }
+            double likelihood = 0.0;
+            for (size_t i = 0; i < n; ++i) {
+                likelihood -= 0.5 * alpha[i] * alpha[i] + std::log(l[i * n + i]);
+            }
+            for (size_t i = n; i-- > 0;) {
+                for (size_t j = i + 1; j < n; ++j) {
+                    alpha[i] -= l[j * n + i] * alpha[j];
+                }
+                alpha[i] /= l[i * n + i];
+            }
+            return likelihood;
+        }
+
+        std::vector<std::vector<double>> x;
+        std::vector<double> y;
+        double mean;
+        double scale;
+        std::vector<double> lengths;
+        std::vector<double> l;
+        std::vector<double> alpha;
+    };
+
+    // Expected improvement over best of a result with this mean and deviation.
+    double expected_improvement(double mean, double deviation, double best)
+    {
+        const double z = (mean - best) / deviation;
+        const double cdf = 0.5 * std::erfc(-z / std::sqrt(2.0));
+        const double pdf = std::exp(-0.5 * z * z) / std::sqrt(2.0 * 3.14159265358979323846);
+        return (mean - best) * cdf + deviation * pdf;
+    }
+}
+
+// Starts with the center and a Latin hypercube, then fits a Gaussian process to all results and evaluates batches of
+// config::threads points of the largest expected improvement, picked one after the other, each believed to score what the model predicts.
+// Stops when the expected improvement falls below ssim_tol or after max_evals.
+void run_bayes(Objective& objective)
+{
+    const int dims = static_cast<int>(objective.space.axes.size());
+    if (!dims) {
+        objective.evaluate({ {} });
+        return;
+    }
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    const int batch = static_cast<int>(objective.sweep.engines.size());
+
+    // Initial design.
+    const int initial = std::min(objective.budget, std::max(2 * dims + 2, batch));
+    std::vector<std::vector<double>> points(initial, std::vector<double>(dims, 0.5));
+    for (int i = 0; i < dims; ++i) {
+        std::vector<int> strata(initial - 1);
+        std::iota(strata.begin(), strata.end(), 0);
+        std::shuffle(strata.begin(), strata.end(), generator);
+        for (int j = 1; j < initial; ++j) {
+            points[j][i] = (strata[j - 1] + uniform(generator)) / (initial - 1);
+        }
+    }
+    std::vector<double> results = objective.evaluate(points);
+
+    Gaussian_process model;
+    while (!objective.exhausted()) {
+        model.fit(points, results);
+        const double best = *std::max_element(results.begin(), results.end());
+
+        // Candidates are uniform and around the best points so far, the best of them is refined by shrinking perturbations.
+        std::vector<size_t> order(results.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return results[a] > results[b]; });
+        auto improvement = [&](const std::vector<double>& x) {
+            double mean;
+            double deviation;
+            model.predict(x, mean, deviation);
+            return expected_improvement(mean, deviation, best);
+        };
+        const int n = std::min(batch, objective.budget - objective.evaluations);
+        std::vector<std::vector<double>> picks;
+        double largest = 0.0;
+        for (int pick = 0; pick < n; ++pick) {
+            std::vector<double> candidate(dims);
+            std::vector<double> chosen;
+            double chosen_improvement = -1.0;
+            for (int i = 0; i < 1024; ++i) {
+                for (int j = 0; j < dims; ++j) {
+                    if (i < 512) {
+                        candidate[j] = uniform(generator);
+                    }
+                    else {
+                        const auto& center = points[order[i % std::min<size_t>(order.size(), 5)]];
+                        candidate[j] = std::clamp(center[j] + 0.05 * normal(generator), 0.0, 1.0);
+                    }
+                }
+                const double value = improvement(candidate);
+                if (value > chosen_improvement) {
+                    chosen_improvement = value;
+                    chosen = candidate;
+                }
+            }
+            for (double step = 0.02; step > 1e-4; step *= 0.5) {
+                for (int i = 0; i < 8 * dims; ++i) {
+                    for (int j = 0; j < dims; ++j) {
+                        candidate[j] = std::clamp(chosen[j] + step * normal(generator), 0.0, 1.0);
+                    }
+                    const double value = improvement(candidate);
+                    if (value > chosen_improvement) {
+                        chosen_improvement = value;
+                        chosen = candidate;
+                    }
+                }
+            }
+            if (!pick) {
+                largest = chosen_improvement;
+            }
+            picks.push_back(chosen);
+            if (pick + 1 < n) {
+                model.add_believed(chosen);
+            }
+        }
+        if (largest < config::ssim_tol) {
+            break;
+        }
+        const std::vector<double> picked = objective.evaluate(picks);
+        points.insert(points.end(), picks.begin(), picks.end());
+        results.insert(results.end(), picked.begin(), picked.end());
+    }
+}
@@ -0,0 +1,211 @@
+#include "optimizer.h"
+#include "config.h"
+
+// Eigendecomposition of the symmetric n x n matrix a, row-major, by cyclic Jacobi rotations.
+// On return values holds the eigenvalues and the columns of vectors the eigenvectors.
+static void eigen_symmetric(std::vector<double> a, int n, std::vector<double>& values, std::vector<double>& vectors)
+{
+    vectors.assign(static_cast<size_t>(n) * n, 0.0);
+    for (int i = 0; i < n; ++i) {
+        vectors[i * n + i] = 1.0;
+    }
+    for (int sweep = 0; sweep < 50; ++sweep) {
+        double off = 0.0;
+        for (int p = 0; p < n; ++p) {
+            for (int q = p + 1; q < n; ++q) {
+                off += a[p * n + q] * a[p * n + q];
+            }
+        }
+        if (off < 1e-30) {
+            break;
+        }
+        for (int p = 0; p < n; ++p) {
+            for (int q = p + 1; q < n; ++q) {
+                if (a[p * n + q] == 0.0) {
+                    continue;
+                }
+                const double theta = (a[q * n + q] - a[p * n + p]) / (2.0 * a[p * n + q]);
+                const double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+                const double c = 1.0 / std::sqrt(t * t + 1.0);
+                const double s = t * c;
+                for (int k = 0; k < n; ++k) {
+                    const double akp = a[k * n + p];
+                    const double akq = a[k * n + q];
+                    a[k * n + p] = c * akp - s * akq;
+                    a[k * n + q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < n; ++k) {
+                    const double apk = a[p * n + k];
+                    const double aqk = a[q * n + k];
+                    a[p * n + k] = c * apk - s * aqk;
+                    a[q * n + k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < n; ++k) {
+                    const double vkp = vectors[k * n + p];
+                    const double vkq = vectors[k * n + q];
+                    vectors[k * n + p] = c * vkp - s * vkq;
+                    vectors[k * n + q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+    values.resize(n);
+    for (int i = 0; i < n; ++i) {
+        values[i] = a[i * n + i];
+    }
+}
+
+// CMA-ES with the default parameters of Hansen's tutorial, seeded from the center of the box with a step size of 0.3 of it.
+// The population is the default one rounded up to a multiple of the threads and is evaluated on all of them at once.
+// Samples outside of the box are evaluated clamped into it and ranked with a penalty for the distance,
+// which keeps the mean inside, the covariance is adapted from the samples themselves.
+// Stops when the best SSIM improves by less than ssim_tol over 10 + 30 n / lambda generations,
+// when the steps are below x_tol or after max_evals.
+void run_cmaes(Objective& objective)
+{
+    const int n = static_cast<int>(objective.space.axes.size());
+    if (!n) {
+        objective.evaluate({ {} });
+        return;
+    }
+    const int threads = static_cast<int>(objective.sweep.engines.size());
+    const int lambda = (4 + static_cast<int>(3.0 * std::log(n)) + threads - 1) / threads * threads;
+    const int mu = lambda / 2;
+    std::vector<double> weights(mu);
+    for (int i = 0; i < mu; ++i) {
+        weights[i] = std::log(mu + 0.5) - std::log(i + 1.0);
+    }
+    const double weight_sum = std::accumulate(weights.begin(), weights.end(), 0.0);
+    double weight_sq_sum = 0.0;
+    for (auto& w : weights) {
+        w /= weight_sum;
+        weight_sq_sum += w * w;
+    }
+    const double mu_eff = 1.0 / weight_sq_sum;
+    const double c_sigma = (mu_eff + 2.0) / (n + mu_eff + 5.0);
+    const double d_sigma = 1.0 + 2.0 * std::max(0.0, std::sqrt((mu_eff - 1.0) / (n + 1.0)) - 1.0) + c_sigma;
+    const double c_c = (4.0 + mu_eff / n) / (n + 4.0 + 2.0 * mu_eff / n);
+    const double c_1 = 2.0 / ((n + 1.3) * (n + 1.3) + mu_eff);
+    const double c_mu = std::min(1.0 - c_1, 2.0 * (mu_eff - 2.0 + 1.0 / mu_eff) / ((n + 2.0) * (n + 2.0) + mu_eff));
+    const double chi_n = std::sqrt(n) * (1.0 - 1.0 / (4.0 * n) + 1.0 / (21.0 * n * n));
+    const size_t history = 10 + (30 * n + lambda - 1) / lambda;
+
+    std::vector<double> mean(n, 0.5);
+    double sigma = 0.3;
+    std::vector<double> c(static_cast<size_t>(n) * n, 0.0);
+    for (int i = 0; i < n; ++i) {
+        c[i * n + i] = 1.0;
+    }
+    std::vector<double> p_sigma(n, 0.0);
+    std::vector<double> p_c(n, 0.0);
+    std::vector<double> eigenvalues;
+    std::vector<double> b;
+    std::vector<double> best_history;
+    double best = -std::numeric_limits<double>::infinity();
+    std::mt19937 generator(1);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    for (int generation = 0; !objective.exhausted(); ++generation) {
+
+        // C = B D^2 B^T.
+        eigen_symmetric(c, n, eigenvalues, b);
+        std::vector<double> d(n);
+        for (int i = 0; i < n; ++i) {
+            d[i] = std::sqrt(std::max(eigenvalues[i], 1e-20));
+        }
+
+        // Sample y = B D z, x = mean + sigma y.
+        const int count = std::min(lambda, objective.budget - objective.evaluations);
+        std::vector<std::vector<double>> y(count, std::vector<double>(n));
+        std::vector<std::vector<double>> x(count, std::vector<double>(n));
+        std::vector<std::vector<double>> clamped(count, std::vector<double>(n));
+        for (int k = 0; k < count; ++k) {
+            std::vector<double> z(n);
+            for (auto& value : z) {
+                value = normal(generator);
+            }
+            for (int i = 0; i < n; ++i) {
+                y[k][i] = 0.0;
+                for (int j = 0; j < n; ++j) {
+                    y[k][i] += b[i * n + j] * d[j] * z[j];
+                }
+                x[k][i] = mean[i] + sigma * y[k][i];
+                clamped[k][i] = std::clamp(x[k][i], 0.0, 1.0);
+            }
+        }
+        const std::vector<double> results = objective.evaluate(clamped);
+        best = std::max(best, *std::max_element(results.begin(), results.end()));
+        best_history.push_back(best);
+        if (count < lambda) {
+            break;
+        }
+
+        // Penalty scaled by the spread of the generation, so it matters next to SSIM differences of any size.
+        const double spread = *std::max_element(results.begin(), results.end()) - *std::min_element(results.begin(), results.end());
+        std::vector<double> ranked(count);
+        for (int k = 0; k < count; ++k) {
+            double distance = 0.0;
+            for (int i = 0; i < n; ++i) {
+                distance += (x[k][i] - clamped[k][i]) * (x[k][i] - clamped[k][i]);
+            }
+            ranked[k] = results[k] - (spread + 1e-12) * 10.0 * distance / (sigma * sigma);
+        }
+        std::vector<int> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](int a, int b) { return ranked[a] > ranked[b]; });
+
+        // Recombination.
+        std::vector<double> y_w(n, 0.0);
+        for (int k = 0; k < mu; ++k) {
+            for (int i = 0; i < n; ++i) {
+                y_w[i] += weights[k] * y[order[k]][i];
+            }
+        }
+        for (int i = 0; i < n; ++i) {
+            mean[i] += sigma * y_w[i];
+        }
+
+        // Evolution paths, C^-1/2 = B D^-1 B^T.
+        std::vector<double> bt_y(n, 0.0);
+        for (int i = 0; i < n; ++i) {
+            for (int j = 0; j < n; ++j) {
+                bt_y[i] += b[j * n + i] * y_w[j];
+            }
+            bt_y[i] /= d[i];
+        }
+        double p_sigma_norm = 0.0;
+        for (int i = 0; i < n; ++i) {
+            double whitened = 0.0;
+            for (int j = 0; j < n; ++j) {
+                whitened += b[i * n + j] * bt_y[j];
+            }
+            p_sigma[i] = (1.0 - c_sigma) * p_sigma[i] + std::sqrt(c_sigma * (2.0 - c_sigma) * mu_eff) * whitened;
+            p_sigma_norm += p_sigma[i] * p_sigma[i];
+        }
+        p_sigma_norm = std::sqrt(p_sigma_norm);
+        const bool h_sigma = p_sigma_norm / std::sqrt(1.0 - std::pow(1.0 - c_sigma, 2.0 * (generation + 1))) / chi_n < 1.4 + 2.0 / (n + 1.0);
+        for (int i = 0; i < n; ++i) {
+            p_c[i] = (1.0 - c_c) * p_c[i] + (h_sigma ? std::sqrt(c_c * (2.0 - c_c) * mu_eff) : 0.0) * y_w[i];
+        }
+
+        // Covariance, rank one and rank mu updates.
+        for (int i = 0; i < n; ++i) {
+            for (int j = 0; j < n; ++j) {
+                double rank_mu = 0.0;
+                for (int k = 0; k < mu; ++k) {
+                    rank_mu += weights[k] * y[order[k]][i] * y[order[k]][j];
+                }
+                c[i * n + j] = (1.0 - c_1 - c_mu) * c[i * n + j] + c_1 * (p_c[i] * p_c[j] + (h_sigma ? 0.0 : c_c * (2.0 - c_c) * c[i * n + j])) + c_mu * rank_mu;
+            }
+        }
+        sigma *= std::exp(c_sigma / d_sigma * (p_sigma_norm / chi_n - 1.0));
+
+        // Converged?
+        const double step = sigma * std::sqrt(*std::max_element(eigenvalues.begin(), eigenvalues.end()));
+        if (step < config::x_tol) {
+            break;
+        }
+        if (best_history.size() > history && best - best_history[best_history.size() - 1 - history] < config::ssim_tol) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,286 @@
+#include "optimizer.h"
+#include "config.h"
+
+// Pairs of steps and gradient changes the Hessian approximation is built from.
+static constexpr int lbfgs_memory = 5;
+
+// Limited memory BFGS approximation of the Hessian, n x n, row-major.
+// There are at most 3 free axes, so it's formed densely by applying the updates of the pairs, oldest first, to theta I,
+// which is the matrix the compact representation of L-BFGS-B stands for.
+static std::vector<double> lbfgs_hessian(const std::deque<std::vector<double>>& steps, const std::deque<std::vector<double>>& changes, int n)
+{
+    double theta = 1.0;
+    if (!steps.empty()) {
+        const auto& s = steps.back();
+        const auto& y = changes.back();
+        theta = std::inner_product(y.begin(), y.end(), y.begin(), 0.0) / std::inner_product(s.begin(), s.end(), y.begin(), 0.0);
+    }
+    std::vector<double> b(static_cast<size_t>(n) * n, 0.0);
+    for (int i = 0; i < n; ++i) {
+        b[i * n + i] = theta;
+    }
+    for (size_t k = 0; k < steps.size(); ++k) {
+        const auto& s = steps[k];
+        const auto& y = changes[k];
+        std::vector<double> bs(n, 0.0);
+        for (int i = 0; i < n; ++i) {
+            for (int j = 0; j < n; ++j) {
+                bs[i] += b[i * n + j] * s[j];
+            }
+        }
+        const double sbs = std::inner_product(s.begin(), s.end(), bs.begin(), 0.0);
+        const double sy = std::inner_product(s.begin(), s.end(), y.begin(), 0.0);
+        for (int i = 0; i < n; ++i) {
+            for (int j = 0; j < n; ++j) {
+                b[i * n + j] += y[i] * y[j] / sy - bs[i] * bs[j] / sbs;
+            }
+        }
+    }
+    return b;
+}
+
+// Generalized Cauchy point, the first minimizer of the model g^T p + p^T B p / 2 along the projected steepest descent path
+// P(x - t g), segment by segment between the breakpoints where axes reach the bounds of the unit cube.
+static std::vector<double> cauchy_point(const std::vector<double>& x, const std::vector<double>& g, const std::vector<double>& b)
+{
+    const int n = static_cast<int>(x.size());
+    std::vector<double> breakpoints(n);
+    std::vector<double> d(n);
+    for (int i = 0; i < n; ++i) {
+        breakpoints[i] = g[i] < 0.0 ? (x[i] - 1.0) / g[i] : g[i] > 0.0 ? x[i] / g[i] : std::numeric_limits<double>::infinity();
+        d[i] = breakpoints[i] > 0.0 ? -g[i] : 0.0;
+    }
+    std::vector<double> p(n, 0.0);
+    double t = 0.0;
+    while (std::any_of(d.begin(), d.end(), [](double value) { return value != 0.0; })) {
+        double next = std::numeric_limits<double>::infinity();
+        for (int i = 0; i < n; ++i) {
+            if (d[i] != 0.0) {
+                next = std::min(next, breakpoints[i]);
+            }
+        }
+
+        // Slope and curvature of the model along d at p.
+        double slope = 0.0;
+        double curvature = 0.0;
+        for (int i = 0; i < n; ++i) {
+            double bd = 0.0;
+            double bp = 0.0;
+            for (int j = 0; j < n; ++j) {
+                bd += b[i * n + j] * d[j];
+                bp += b[i * n + j] * p[j];
+            }
+            slope += d[i] * (g[i] + bp);
+            curvature += d[i] * bd;
+        }
+        if (slope >= 0.0) {
+            break;
+        }
+        const double dt = curvature > 0.0 ? -slope / curvature : std::numeric_limits<double>::infinity();
+        if (t + dt < next) {
+            for (int i = 0; i < n; ++i) {
+                p[i] += dt * d[i];
+            }
+            break;
+        }
+
+        // Axes reaching their bound stay there.
+        for (int i = 0; i < n; ++i) {
+            if (d[i] != 0.0 && breakpoints[i] <= next) {
+                p[i] = (g[i] < 0.0 ? 1.0 : 0.0) - x[i];
+                d[i] = 0.0;
+            }
+            else {
+                p[i] += (next - t) * d[i];
+            }
+        }
+        t = next;
+    }
+    std::vector<double> cauchy(n);
+    for (int i = 0; i < n; ++i) {
+        cauchy[i] = std::clamp(x[i] + p[i], 0.0, 1.0);
+    }
+    return cauchy;
+}
+
+// Minimizes the model over the axes that are free at the Cauchy point, with the others held there,
+// and goes from the Cauchy point towards that minimizer until a bound is hit.
+static std::vector<double> subspace_minimum(const std::vector<double>& x, const std::vector<double>& g, const std::vector<double>& b, const std::vector<double>& cauchy)
+{
+    const int n = static_cast<int>(x.size());
+    std::vector<int> free;
+    for (int i = 0; i < n; ++i) {
+        if (cauchy[i] > 0.0 && cauchy[i] < 1.0) {
+            free.push_back(i);
+        }
+    }
+    const int m = static_cast<int>(free.size());
+    if (!m) {
+        return cauchy;
+    }
+
+    // Reduced system B_FF z = -(g + B (cauchy - x))_F, by Gaussian elimination with partial pivoting.
+    std::vector<double> a(static_cast<size_t>(m) * (m + 1));
+    for (int i = 0; i < m; ++i) {
+        double r = g[free[i]];
+        for (int j = 0; j < n; ++j) {
+            r += b[free[i] * n + j] * (cauchy[j] - x[j]);
+        }
+        for (int j = 0; j < m; ++j) {
+            a[i * (m + 1) + j] = b[free[i] * n + free[j]];
+        }
+        a[i * (m + 1) + m] = -r;
+    }
+    for (int k = 0; k < m; ++k) {
+        int pivot = k;
+        for (int i = k + 1; i < m; ++i) {
+            if (std::abs(a[i * (m + 1) + k]) > std::abs(a[pivot * (m + 1) + k])) {
+                pivot = i;
+            }
+        }
+        for (int j = 0; j <= m; ++j) {
+            std::swap(a[k * (m + 1) + j], a[pivot * (m + 1) + j]);
+        }
+        if (a[k * (m + 1) + k] == 0.0) {
+            return cauchy;
+        }
+        for (int i = k + 1; i < m; ++i) {
+            const double factor = a[i * (m + 1) + k] / a[k * (m + 1) + k];
+            for (int j = k; j <= m; ++j) {
+                a[i * (m + 1) + j] -= factor * a[k * (m + 1) + j];
+            }
+        }
+    }
+    std::vector<double> z(m);
+    for (int i = m - 1; i >= 0; --i) {
+        double value = a[i * (m + 1) + m];
+        for (int j = i + 1; j < m; ++j) {
+            value -= a[i * (m + 1) + j] * z[j];
+        }
+        z[i] = value / a[i * (m + 1) + i];
+    }
+
+    double alpha = 1.0;
+    for (int i = 0; i < m; ++i) {
+        if (z[i] > 0.0) {
+            alpha = std::min(alpha, (1.0 - cauchy[free[i]]) / z[i]);
+        }
+        else if (z[i] < 0.0) {
+            alpha = std::min(alpha, -cauchy[free[i]] / z[i]);
+        }
+    }
+    std::vector<double> minimum = cauchy;
+    for (int i = 0; i < m; ++i) {
+        minimum[free[i]] = std::clamp(cauchy[free[i]] + alpha * z[i], 0.0, 1.0);
+    }
+    return minimum;
+}
+
+// Minimizes -SSIM over the unit cube with L-BFGS-B (Byrd, Lu, Nocedal and Zhu): generalized Cauchy point, subspace minimization
+// and a backtracking line search for the sufficient decrease, with the gradient of Ssim_gradient.
+// The first step is scaled to unit length, later ones start at the model's minimum.
+// Stops when the projected gradient is 0, SSIM improves by less than ssim_tol, the steps are below x_tol or after max_evals.
+void run_lbfgsb(Objective& objective)
+{
+    const int dims = static_cast<int>(objective.space.axes.size());
+    run_restarts(objective, [&](Sweep_engine& engine, std::vector<double> x) {
+        auto evaluate = [&](const std::vector<double>& point, std::vector<double>& g) {
+            const double f = -objective.evaluate_gradient(engine, point, g);
+            for (auto& value : g) {
+                value = -value;
+            }
+            return f;
+        };
+        std::vector<double> g;
+        double f = evaluate(x, g);
+        std::deque<std::vector<double>> steps;
+        std::deque<std::vector<double>> changes;
+        while (dims > 0 && !objective.exhausted()) {
+            double projected = 0.0;
+            for (int i = 0; i < dims; ++i) {
+                projected = std::max(projected, std::abs(std::clamp(x[i] - g[i], 0.0, 1.0) - x[i]));
+            }
+            if (projected == 0.0) {
+                break;
+            }
+
+            const std::vector<double> b = lbfgs_hessian(steps, changes, dims);
+            const std::vector<double> target = subspace_minimum(x, g, b, cauchy_point(x, g, b));
+            std::vector<double> d(dims);
+            for (int i = 0; i < dims; ++i) {
+                d[i] = target[i] - x[i];
+            }
+            const double slope = std::inner_product(g.begin(), g.end(), d.begin(), 0.0);
+
+            // The approximation can go bad on a function this flat, start it over.
+            if (slope >= 0.0) {
+                if (steps.empty()) {
+                    break;
+                }
+                steps.clear();
+                changes.clear();
+                continue;
+            }
+
+            // Without pairs d is just the gradient, the first step goes a unit length along it, or up to the cube.
+            double length = 1.0;
+            if (steps.empty()) {
+                length = 1.0 / std::sqrt(std::inner_product(d.begin(), d.end(), d.begin(), 0.0));
+                for (int i = 0; i < dims; ++i) {
+                    if (d[i] != 0.0) {
+                        length = std::min(length, ((d[i] > 0.0 ? 1.0 : 0.0) - x[i]) / d[i]);
+                    }
+                }
+            }
+            const double d_max = std::abs(*std::max_element(d.begin(), d.end(), [](double a, double b) { return std::abs(a) < std::abs(b); }));
+            std::vector<double> x_next(dims);
+            std::vector<double> g_next;
+            double f_next;
+            bool decreased = false;
+            while (!objective.exhausted()) {
+                for (int i = 0; i < dims; ++i) {
+                    x_next[i] = std::clamp(x[i] + length * d[i], 0.0, 1.0);
+                }
+                f_next = evaluate(x_next, g_next);
+                if (f_next <= f + 1e-4 * length * slope) {
+                    decreased = true;
+                    break;
+                }
+                if (length * d_max < config::x_tol) {
+                    break;
+                }
+
+                // Minimum of the quadratic through f, the slope and f_next, kept within [0.1, 0.5] of the step.
+                const double quadratic = -slope * length * length / (2.0 * (f_next - f - slope * length));
+                length = std::clamp(quadratic, 0.1 * length, 0.5 * length);
+            }
+            if (!decreased) {
+                break;
+            }
+
+            // Pairs without positive curvature would break the approximation.
+            std::vector<double> s(dims);
+            std::vector<double> y(dims);
+            for (int i = 0; i < dims; ++i) {
+                s[i] = x_next[i] - x[i];
+                y[i] = g_next[i] - g[i];
+            }
+            if (std::inner_product(s.begin(), s.end(), y.begin(), 0.0) > std::numeric_limits<double>::epsilon() * std::inner_product(y.begin(), y.end(), y.begin(), 0.0)) {
+                steps.push_back(s);
+                changes.push_back(y);
+                if (steps.size() > lbfgs_memory) {
+                    steps.pop_front();
+                    changes.pop_front();
+                }
+            }
+            const double improvement = f - f_next;
+            const double step = std::abs(*std::max_element(s.begin(), s.end(), [](double a, double b) { return std::abs(a) < std::abs(b); }));
+            x = x_next;
+            f = f_next;
+            g = g_next;
+            if (improvement < config::ssim_tol || step < config::x_tol) {
+                break;
+            }
+        }
+    });
+}
@@ -0,0 +1,951 @@
+#include "resample.h"
+
+void create_plane(Plane& plane, int width, int height)
+{
+    plane.width = width;
+    plane.height = height;
+    plane.pitch = round_up(width, panel_lines);
+    plane.data.assign(static_cast<size_t>(plane.pitch) * round_up(height, panel_lines), 0.0f);
+}
+
+template <typename Kernel>
+static void create_weight_table(Weight_table& table, const Kernel_params& k, float scale, int src_size, int dst_size)
+{
+    const Kernel kernel(k);
+    const float s = std::min(scale, 1.0f);
+    const int bound = static_cast<int>(std::ceil(k.radius / s));
+    table.size = round_up(dst_size, panel_lines);
+    table.src_size = src_size;
+    table.taps = 2 * bound;
+    table.first.resize(table.size);
+    table.begin.assign(table.size, 0);
+    table.end.assign(table.size, 2 * bound);
+    table.weights.resize(static_cast<size_t>(table.size) * table.taps);
+    for (int o = 0; o < table.size; ++o) {
+
+        // Padding repeats the last output sample.
+        const int oc = std::min(o, dst_size - 1);
+        const double f = sample_fraction(oc, src_size, dst_size);
+        table.first[o] = sample_base(oc, src_size, dst_size) + 1 - bound;
+        float* w = &table.weights[static_cast<size_t>(o) * table.taps];
+        double wsum = 0.0;
+        for (int i = 0; i < table.taps; ++i) {
+            const double weight = kernel(std::abs((i + 1 - bound - f) * s));
+            w[i] = static_cast<float>(weight);
+            wsum += weight;
+        }
+
+        // Normalize weights.
+        for (int i = 0; i < table.taps; ++i) {
+            w[i] = static_cast<float>(w[i] / wsum);
+        }
+    }
+}
+
+template <typename Kernel>
+struct Create_weight_table_instance
+{
+    static constexpr Create_weight_table function = create_weight_table<Kernel>;
+};
+
+// Distances of all taps first, then the kernel over all of them with the vector math of isa.
+template <Isa isa, bool precise>
+static void create_weight_table_vector(Weight_table& table, const Kernel_params& k, float scale, int src_size, int dst_size)
+{
+    const float s = std::min(scale, 1.0f);
+    const int bound = static_cast<int>(std::ceil(k.radius / s));
+    table.size = round_up(dst_size, panel_lines);
+    table.src_size = src_size;
+    table.taps = 2 * bound;
+    table.first.resize(table.size);
+    table.begin.assign(table.size, 0);
+    table.end.assign(table.size, 2 * bound);
+    const int count = table.size * table.taps;
+    table.weights.resize(count);
+    for (int o = 0; o < table.size; ++o) {
+
+        // Padding repeats the last output sample.
+        const int oc = std::min(o, dst_size - 1);
+        const double f = sample_fraction(oc, src_size, dst_size);
+        table.first[o] = sample_base(oc, src_size, dst_size) + 1 - bound;
+        float* w = &table.weights[static_cast<size_t>(o) * table.taps];
+        for (int i = 0; i < table.taps; ++i) {
+            w[i] = static_cast<float>(std::abs((i + 1 - bound - f) * s));
+        }
+    }
+
+    // The kernel is picked per table, it's evaluated over all of it at once.
+    float* w = table.weights.data();
+    if (k.index == KERNEL_FUNCTION_PLUGIN) {
+        kernels::Plugin<false>(k).evaluate(w, w, count);
+    }
+    else if constexpr (isa == ISA_AVX512) {
+        get_evaluate_kernel_avx512(k.index, precise)(k, w, count);
+    }
+    else {
+        get_evaluate_kernel_avx2(k.index, precise)(k, w, count);
+    }
+
+    // Normalize weights.
+    for (int o = 0; o < table.size; ++o) {
+        float* w = &table.weights[static_cast<size_t>(o) * table.taps];
+        double wsum = 0.0;
+        for (int i = 0; i < table.taps; ++i) {
+            wsum += w[i];
+        }
+        for (int i = 0; i < table.taps; ++i) {
+            w[i] = static_cast<float>(w[i] / wsum);
+        }
+    }
+}
+
+Create_weight_table get_create_weight_table(Isa isa, int kernel, bool precise)
+{
+    switch (isa) {
+        case ISA_AVX512:
+            return precise ? create_weight_table_vector<ISA_AVX512, true> : create_weight_table_vector<ISA_AVX512, false>;
+        case ISA_AVX2:
+            return precise ? create_weight_table_vector<ISA_AVX2, true> : create_weight_table_vector<ISA_AVX2, false>;
+        default:
+            return select_kernel<false, Create_weight_table_instance>(kernel);
+    }
+}
+
+void sparsify_weight_table(Weight_table& table, float epsilon)
+{
+    const int bound = table.taps / 2;
+    for (int o = 0; o < table.size; ++o) {
+        float* w = &table.weights[static_cast<size_t>(o) * table.taps];
+        int begin = 0;
+        while (begin < bound - 1 && std::abs(w[begin]) <= epsilon) {
+            ++begin;
+        }
+        int end = table.taps;
+        while (end > bound + 1 && std::abs(w[end - 1]) <= epsilon) {
+            --end;
+        }
+        table.begin[o] = begin;
+        table.end[o] = end;
+        if (epsilon > 0.0f) {
+            std::fill(w, w + begin, 0.0f);
+            std::fill(w + end, w + table.taps, 0.0f);
+
+            // Normalize weights.
+            double wsum = 0.0;
+            for (int i = begin; i < end; ++i) {
+                wsum += w[i];
+            }
+            for (int i = begin; i < end; ++i) {
+                w[i] = static_cast<float>(w[i] / wsum);
+            }
+        }
+    }
+}
+
+void fold_weight_table(Weight_table& table)
+{
+    for (int o = 0; o < table.size; ++o) {
+        float* w = &table.weights[static_cast<size_t>(o) * table.taps];
+
+        // Taps [lo, hi) are inside of the source.
+        const int lo = -table.first[o];
+        const int hi = table.src_size - table.first[o];
+        int& begin = table.begin[o];
+        int& end = table.end[o];
+        for (int i = begin; i < std::min(lo, end); ++i) {
+            w[lo] += w[i];
+            w[i] = 0.0f;
+        }
+        for (int i = std::max(hi, begin); i < end; ++i) {
+            w[hi - 1] += w[i];
+            w[i] = 0.0f;
+        }
+        begin = std::clamp(begin, lo, hi - 1);
+        end = std::clamp(end, lo + 1, hi);
+        int i0;
+        int i1;
+        antiringing_taps(table, o, i0, i1);
+        begin = std::min(begin, i0);
+        end = std::max(end, i1 + 1);
+    }
+}
+
+void create_box_weight_table(Weight_table& box, const Weight_table& table, int dst_size, int factor)
+{
+    // Box of ImageMetrics::SubSample(), an even one is shifted right.
+    int lo = -factor / 2;
+    const int hi = factor / 2;
+    if (factor % 2 == 0) {
+        ++lo;
+    }
+
+    // Outputs of box s, only the first box reflects at the edge.
+    const int size = dst_size / factor;
+    auto output = [&](int s, int i) {
+        const int o = std::min(s, size - 1) * factor + i;
+        return o < 0 ? -o - 1 : o;
+    };
+
+    // The firsts of a box spread by the same amount in every table of a batch, so they still share first and taps.
+    box.size = round_up(size, panel_lines);
+    box.src_size = table.src_size;
+    box.first.resize(box.size);
+    int spread = 0;
+    for (int s = 0; s < box.size; ++s) {
+        int first_lo = std::numeric_limits<int>::max();
+        int first_hi = std::numeric_limits<int>::min();
+        for (int i = lo; i <= hi; ++i) {
+            first_lo = std::min(first_lo, table.first[output(s, i)]);
+            first_hi = std::max(first_hi, table.first[output(s, i)]);
+        }
+        box.first[s] = first_lo;
+        spread = std::max(spread, first_hi - first_lo);
+    }
+    box.taps = table.taps + spread;
+    box.begin.assign(box.size, box.taps);
+    box.end.assign(box.size, 0);
+    box.weights.assign(static_cast<size_t>(box.size) * box.taps, 0.0f);
+    const float norm = 1.0f / static_cast<float>(factor);
+    for (int s = 0; s < box.size; ++s) {
+        float* w = &box.weights[static_cast<size_t>(s) * box.taps];
+        for (int i = lo; i <= hi; ++i) {
+            const int o = output(s, i);
+            const int shift = table.first[o] - box.first[s];
+            for (int k = table.begin[o]; k < table.end[o]; ++k) {
+                w[shift + k] += table.weights[static_cast<size_t>(o) * table.taps + k] * norm;
+            }
+            box.begin[s] = std::min(box.begin[s], shift + table.begin[o]);
+            box.end[s] = std::max(box.end[s], shift + table.end[o]);
+        }
+    }
+}
+
+void slice_weight_table(const Weight_table& table, int begin, int size, Weight_table& slice)
+{
+    slice.size = size;
+    slice.src_size = table.src_size;
+    slice.taps = table.taps;
+    slice.first.assign(table.first.begin() + begin, table.first.begin() + begin + size);
+    slice.begin.assign(table.begin.begin() + begin, table.begin.begin() + begin + size);
+    slice.end.assign(table.end.begin() + begin, table.end.begin() + begin + size);
+    const auto weights = table.weights.begin() + static_cast<ptrdiff_t>(begin) * table.taps;
+    slice.weights.assign(weights, weights + static_cast<ptrdiff_t>(size) * table.taps);
+}
+
+template <bool half_in, bool half_out>
+static void resample_lines(Lines in, int lines, const Weight_table* const* tables, int n, float ar, const Lines* out, bool transpose)
+{
+    const Weight_table& table = *tables[0];
+    for (int l0 = 0; l0 < lines; l0 += panel_lines) {
+        const Element<half_in>* src = elements<half_in>(in) + l0 / panel_lines * in.panel;
+        for (int o = 0; o < table.size; ++o) {
+
+            // Taps outside of every table's range have zero weight.
+            int begin = table.begin[o];
+            int end = table.end[o];
+            for (int b = 1; b < n; ++b) {
+                begin = std::min(begin, tables[b]->begin[o]);
+                end = std::max(end, tables[b]->end[o]);
+            }
+
+            float csum[max_batch][panel_lines] = {};
+            float color[panel_lines];
+            float c0[panel_lines];
+            float c1[panel_lines];
+            auto tap = [&](int i) {
+                const Element<half_in>* line = src + (table.first[o] + i) * in.step;
+                for (int l = 0; l < panel_lines; ++l) {
+                    color[l] = to_float(line[l]);
+                }
+                for (int b = 0; b < n; ++b) {
+                    const float w = tables[b]->weights[static_cast<size_t>(o) * table.taps + i];
+                    for (int l = 0; l < panel_lines; ++l) {
+                        csum[b][l] += color[l] * w;
+                    }
+                }
+            };
+
+            // Antiringing.
+            // The two taps nearest the sample (i = 0 and i = 1 in the shader) give lo and hi.
+            // Next to the edges both can clamp to the same sample.
+            if (ar > 0.0f) {
+                int i0;
+                int i1;
+                antiringing_taps(table, o, i0, i1);
+                for (int i = begin; i < i0; ++i) {
+                    tap(i);
+                }
+                tap(i0);
+                std::copy(color, color + panel_lines, c0);
+                if (i1 > i0) {
+                    tap(i1);
+                }
+                std::copy(color, color + panel_lines, c1);
+                for (int i = i1 + 1; i < end; ++i) {
+                    tap(i);
+                }
+                for (int b = 0; b < n; ++b) {
+                    for (int l = 0; l < panel_lines; ++l) {
+                        const float clamped = std::clamp(csum[b][l], std::min(c0[l], c1[l]), std::max(c0[l], c1[l]));
+                        csum[b][l] += (clamped - csum[b][l]) * ar;
+                    }
+                }
+            }
+            else {
+                for (int i = begin; i < end; ++i) {
+                    tap(i);
+                }
+            }
+
+            for (int b = 0; b < n; ++b) {
+                Element<half_out>* dst = elements<half_out>(out[b]);
+                for (int l = 0; l < panel_lines; ++l) {
+                    if (out[b].srgb) {
+                        csum[b][l] = linear_to_srgb(csum[b][l]);
+                    }
+                    if (transpose) {
+                        store_element(dst + o / panel_lines * out[b].panel + (l0 + l) * out[b].step + o % panel_lines, csum[b][l]);
+                    }
+                    else {
+                        store_element(dst + l0 / panel_lines * out[b].panel + o * out[b].step + l, csum[b][l]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void resample_pass_scalar(Lines in, int lines, const Weight_table* const* tables, int n, float ar, const Lines* out, bool transpose)
+{
+    if (in.half) {
+        resample_lines<true, false>(in, lines, tables, n, ar, out, transpose);
+    }
+    else if (out[0].half) {
+        resample_lines<false, true>(in, lines, tables, n, ar, out, transpose);
+    }
+    else {
+        resample_lines<false, false>(in, lines, tables, n, ar, out, transpose);
+    }
+}
+
+static Weight_table_view view_weight_table(const Weight_table& table)
+{
+    return { table.size, table.src_size, table.taps, table.first.data(), table.begin.data(), table.end.data(), table.weights.data() };
+}
+
+template <Isa isa>
+static void resample_pass_vector(Lines in, int lines, const Weight_table* const* tables, int n, float ar, const Lines* out, bool transpose)
+{
+    Weight_table_view views[max_batch];
+    for (int b = 0; b < n; ++b) {
+        views[b] = view_weight_table(*tables[b]);
+    }
+    if constexpr (isa == ISA_AVX512) {
+        resample_pass_avx512(in, lines, views, n, ar, out, transpose);
+    }
+    else {
+        resample_pass_avx2(in, lines, views, n, ar, out, transpose);
+    }
+}
+
+Resample_pass get_resample_pass(Isa isa)
+{
+    switch (isa) {
+        case ISA_AVX512:
+            return resample_pass_vector<ISA_AVX512>;
+        case ISA_AVX2:
+            return resample_pass_vector<ISA_AVX2>;
+        default:
+            return resample_pass_scalar;
+    }
+}
+
+void block_rows(const Plane& in, std::vector<float>& out)
+{
+    const int rows = round_up(in.height, panel_lines);
+    out.assign(static_cast<size_t>(in.pitch) * rows, 0.0f);
+    for (int y = 0; y < in.height; ++y) {
+        float* dst = out.data() + static_cast<size_t>(y / panel_lines) * in.pitch * panel_lines + y % panel_lines;
+        const float* src = in.data.data() + static_cast<size_t>(y) * in.pitch;
+        for (int x = 0; x < in.width; ++x) {
+            dst[x * panel_lines] = src[x];
+        }
+    }
+}
+
+template <typename Kernel>
+static void resample_cylindrical(const Plane& in, const Kernel_params* k, int n, float scale, float ar, bool srgb, Plane* out)
+{
+    Kernel kernel[max_batch];
+    for (int b = 0; b < n; ++b) {
+        kernel[b] = Kernel(k[b]);
+    }
+    const float s = std::min(scale, 1.0f);
+    const int bound = static_cast<int>(std::ceil(k[0].radius / s));
+    for (int oy = 0; oy < out[0].height; ++oy) {
+        const int base_y = sample_base(oy, in.height, out[0].height);
+        const double fy = sample_fraction(oy, in.height, out[0].height);
+        for (int ox = 0; ox < out[0].width; ++ox) {
+            const int base_x = sample_base(ox, in.width, out[0].width);
+            const double fx = sample_fraction(ox, in.width, out[0].width);
+            double csum[max_batch] = {};
+            double wsum[max_batch] = {};
+
+            // Antiringing.
+            float lo = 1e9f;
+            float hi = -1e9f;
+
+            for (int y = 1 - bound; y <= bound; ++y) {
+                const float* row = in.data.data() + static_cast<size_t>(std::clamp(base_y + y, 0, in.height - 1)) * in.pitch;
+                auto tap = [&](int x) {
+                    const float color = row[std::clamp(base_x + x, 0, in.width - 1)];
+                    const double r = std::hypot(x - fx, y - fy) * s;
+                    for (int b = 0; b < n; ++b) {
+                        const double weight = kernel[b](r);
+                        csum[b] += color * weight;
+                        wsum[b] += weight;
+                    }
+                    return color;
+                };
+
+                // Antiringing.
+                // The 2x2 taps nearest the sample give lo and hi.
+                if (ar > 0.0f && (y == 0 || y == 1)) {
+                    for (int x = 1 - bound; x < 0; ++x) {
+                        tap(x);
+                    }
+                    const float c0 = tap(0);
+                    const float c1 = tap(1);
+                    lo = std::min({ lo, c0, c1 });
+                    hi = std::max({ hi, c0, c1 });
+                    for (int x = 2; x <= bound; ++x) {
+                        tap(x);
+                    }
+                }
+                else {
+                    for (int x = 1 - bound; x <= bound; ++x) {
+                        tap(x);
+                    }
+                }
+            }
+
+            for (int b = 0; b < n; ++b) {
+
+                // Normalize weighted color sum.
+                float result = static_cast<float>(csum[b] / wsum[b]);
+
+                // Antiringing.
+                if (ar > 0.0f) {
+                    result += (std::clamp(result, lo, hi) - result) * ar;
+                }
+
+                out[b].data[static_cast<size_t>(oy) * out[b].pitch + ox] = srgb ? linear_to_srgb(result) : result;
+            }
+        }
+    }
+}
+
+template <typename Kernel>
+struct Resample_cylindrical_instance
+{
+    static constexpr Resample_cylindrical function = resample_cylindrical<Kernel>;
+};
+
+static Plane_view view_plane(const Plane& plane)
+{
+    return { plane.width, plane.height, plane.pitch, const_cast<float*>(plane.data.data()) };
+}
+
+// Sample positions of every output sample of an axis.
+static void create_sample_positions(int src_size, int dst_size, std::vector<int>& base, std::vector<double>* fraction)
+{
+    base.resize(dst_size);
+    if (fraction) {
+        fraction->resize(dst_size);
+    }
+    for (int o = 0; o < dst_size; ++o) {
+        base[o] = sample_base(o, src_size, dst_size);
+        if (fraction) {
+            (*fraction)[o] = sample_fraction(o, src_size, dst_size);
+        }
+    }
+}
+
+// The kernel is picked per call, every batch of images.
+template <Isa isa, bool precise>
+static void resample_cylindrical_vector(const Plane& in, const Kernel_params* k, int n, float scale, float ar, bool srgb, Plane* out)
+{
+    constexpr int lanes = isa == ISA_AVX512 ? 16 : 8;
+    Cylindrical_view view;
+    view.in = view_plane(in);
+    for (int b = 0; b < n; ++b) {
+        view.out[b] = view_plane(out[b]);
+    }
+    view.k = k;
+    view.n = n;
+    view.s = std::min(scale, 1.0f);
+    view.ar = ar;
+    view.srgb = srgb;
+    view.bound = static_cast<int>(std::ceil(k[0].radius / view.s));
+    const int taps = 2 * view.bound;
+    view.row_taps = round_up(taps, lanes);
+
+    // Padding lanes are far outside of any radius so their weight is 0.
+    std::vector<float> offsets(view.row_taps, std::numeric_limits<float>::max());
+    for (int x = 0; x < taps; ++x) {
+        offsets[x] = static_cast<float>(x + 1 - view.bound);
+    }
+    view.offsets = offsets.data();
+    std::vector<float> colors(view.row_taps, 0.0f);
+    view.colors = colors.data();
+    std::vector<int> base_x;
+    std::vector<int> base_y;
+    std::vector<double> fx;
+    std::vector<double> fy;
+    create_sample_positions(in.width, out[0].width, base_x, &fx);
+    create_sample_positions(in.height, out[0].height, base_y, &fy);
+    view.base_x = base_x.data();
+    view.fx = fx.data();
+    view.base_y = base_y.data();
+    view.fy = fy.data();
+    if constexpr (isa == ISA_AVX512) {
+        get_resample_cylindrical_avx512(k[0].index, precise)(view);
+    }
+    else {
+        get_resample_cylindrical_avx2(k[0].index, precise)(view);
+    }
+}
+
+Resample_cylindrical get_resample_cylindrical(Isa isa, int kernel, bool precise)
+{
+    switch (isa) {
+        case ISA_AVX512:
+            return precise ? resample_cylindrical_vector<ISA_AVX512, true> : resample_cylindrical_vector<ISA_AVX512, false>;
+        case ISA_AVX2:
+            return precise ? resample_cylindrical_vector<ISA_AVX2, true> : resample_cylindrical_vector<ISA_AVX2, false>;
+        default:
+            return select_kernel<true, Resample_cylindrical_instance>(kernel);
+    }
+}
+
+template <typename Kernel>
+static void create_stencil_table(Stencil_table& table, const Kernel_params& k, float scale, int src_width, int src_height, int dst_width, int dst_height)
+{
+    const Kernel kernel(k);
+    const float s = std::min(scale, 1.0f);
+    const int bound = static_cast<int>(std::ceil(k.radius / s));
+    const int taps = 2 * bound;
+    table.phases_x = dst_width / std::gcd(src_width, dst_width);
+    table.phases_y = dst_height / std::gcd(src_height, dst_height);
+    table.taps = taps;
+    const size_t stencils = static_cast<size_t>(table.phases_x) * table.phases_y;
+    table.begin.resize(stencils * taps);
+    table.end.resize(stencils * taps);
+    table.weights.resize(stencils * taps * taps);
+    for (int py = 0; py < table.phases_y; ++py) {
+        const double fy = sample_fraction(py, src_height, dst_height);
+        for (int px = 0; px < table.phases_x; ++px) {
+            const double fx = sample_fraction(px, src_width, dst_width);
+            const size_t stencil = static_cast<size_t>(py) * table.phases_x + px;
+            float* w = &table.weights[stencil * taps * taps];
+            double wsum = 0.0;
+            for (int y = 0; y < taps; ++y) {
+                for (int x = 0; x < taps; ++x) {
+                    const double weight = kernel(std::hypot(x + 1 - bound - fx, y + 1 - bound - fy) * s);
+                    w[y * taps + x] = static_cast<float>(weight);
+                    wsum += weight;
+                }
+
+                // Trim the row to the disk.
+                int& begin = table.begin[stencil * taps + y];
+                int& end = table.end[stencil * taps + y];
+                begin = 0;
+                while (begin < taps && w[y * taps + begin] == 0.0f) {
+                    ++begin;
+                }
+                end = taps;
+                while (end > begin && w[y * taps + end - 1] == 0.0f) {
+                    --end;
+                }
+            }
+
+            // Normalize weights.
+            for (int i = 0; i < taps * taps; ++i) {
+                w[i] = static_cast<float>(w[i] / wsum);
+            }
+        }
+    }
+}
+
+template <typename Kernel>
+struct Create_stencil_table_instance
+{
+    static constexpr Create_stencil_table function = create_stencil_table<Kernel>;
+};
+
+Create_stencil_table get_create_stencil_table(int kernel)
+{
+    return select_kernel<true, Create_stencil_table_instance>(kernel);
+}
+
+bool use_stencil_table(const Kernel_params& k, float scale, int src_width, int src_height, int dst_width, int dst_height)
+{
+    const int bound = static_cast<int>(std::ceil(k.radius / std::min(scale, 1.0f)));
+    const long long stencils = static_cast<long long>(dst_width / std::gcd(src_width, dst_width)) * (dst_height / std::gcd(src_height, dst_height));
+
+    // Each stencil has to be applied a few times, and all of them have to stay small next to the images.
+    return stencils * 4 <= static_cast<long long>(dst_width) * dst_height && stencils * (2 * bound) * (2 * bound) <= 1 << 22;
+}
+
+bool use_separable_approximation(const Kernel_params& k, float scale, int src_width, int src_height, int dst_width, int dst_height)
+{
+    const int taps = 2 * static_cast<int>(std::ceil(k.radius / std::min(scale, 1.0f)));
+    const int rows = dst_height / std::gcd(src_height, dst_height) * taps;
+    const int cols = dst_width / std::gcd(src_width, dst_width) * taps;
+    return use_stencil_table(k, scale, src_width, src_height, dst_width, dst_height) && rows <= 256 && cols <= 256;
+}
+
+// Singular value decomposition of the rows x cols matrix a, row-major, by one-sided Jacobi rotations.
+// On return the columns of a are the left singular vectors scaled by their singular values, v holds the right singular vectors as columns.
+static void svd(std::vector<double>& a, int rows, int cols, std::vector<double>& v)
+{
+    v.assign(static_cast<size_t>(cols) * cols, 0.0);
+    for (int i = 0; i < cols; ++i) {
+        v[static_cast<size_t>(i) * cols + i] = 1.0;
+    }
+    for (int sweep = 0; sweep < 60; ++sweep) {
+        bool rotated = false;
+        for (int p = 0; p < cols - 1; ++p) {
+            for (int q = p + 1; q < cols; ++q) {
+                double alpha = 0.0;
+                double beta = 0.0;
+                double gamma = 0.0;
+                for (int i = 0; i < rows; ++i) {
+                    const double ap = a[static_cast<size_t>(i) * cols + p];
+                    const double aq = a[static_cast<size_t>(i) * cols + q];
+                    alpha += ap * ap;
+                    beta += aq * aq;
+                    gamma += ap * aq;
+                }
+                if (std::abs(gamma) <= 1e-15 * std::sqrt(alpha * beta)) {
+                    continue;
+                }
+                rotated = true;
+
+                // Rotation that makes columns p and q orthogonal.
+                const double zeta = (beta - alpha) / (2.0 * gamma);
+                const double t = (zeta >= 0.0 ? 1.0 : -1.0) / (std::abs(zeta) + std::sqrt(1.0 + zeta * zeta));
+                const double c = 1.0 / std::sqrt(1.0 + t * t);
+                const double s = c * t;
+                auto rotate = [&](double* m, int count) {
+                    for (int i = 0; i < count; ++i) {
+                        const double mp = m[static_cast<size_t>(i) * cols + p];
+                        const double mq = m[static_cast<size_t>(i) * cols + q];
+                        m[static_cast<size_t>(i) * cols + p] = c * mp - s * mq;
+                        m[static_cast<size_t>(i) * cols + q] = s * mp + c * mq;
+                    }
+                };
+                rotate(a.data(), rows);
+                rotate(v.data(), cols);
+            }
+        }
+        if (!rotated) {
+            break;
+        }
+    }
+}
+
+double create_separable_approximation(const Stencil_table& stencils, int rank, int src_width, int src_height, int dst_width, int dst_height, Weight_table* table_x, Weight_table* table_y, std::vector<float>& norm)
+{
+    const int taps = stencils.taps;
+    const int bound = taps / 2;
+    const int rows = stencils.phases_y * taps;
+    const int cols = stencils.phases_x * taps;
+    std::vector<double> a(static_cast<size_t>(rows) * cols);
+    for (int py = 0; py < stencils.phases_y; ++py) {
+        for (int px = 0; px < stencils.phases_x; ++px) {
+            const float* w = &stencils.weights[(static_cast<size_t>(py) * stencils.phases_x + px) * taps * taps];
+            for (int y = 0; y < taps; ++y) {
+                for (int x = 0; x < taps; ++x) {
+                    a[static_cast<size_t>(py * taps + y) * cols + px * taps + x] = w[y * taps + x];
+                }
+            }
+        }
+    }
+    std::vector<double> v;
+    svd(a, rows, cols, v);
+
+    // Singular values, largest first.
+    std::vector<double> sigma(cols);
+    std::vector<int> order(cols);
+    double total = 0.0;
+    for (int j = 0; j < cols; ++j) {
+        double s = 0.0;
+        for (int i = 0; i < rows; ++i) {
+            s += a[static_cast<size_t>(i) * cols + j] * a[static_cast<size_t>(i) * cols + j];
+        }
+        sigma[j] = std::sqrt(s);
+        total += s;
+        order[j] = j;
+    }
+    std::sort(order.begin(), order.end(), [&](int i, int j) { return sigma[i] > sigma[j]; });
+
+    // Term k is column order[k] of a (u scaled by sigma) and of v, both repeated with the phase of the output sample.
+    auto create_table = [&](Weight_table& table, int src_size, int dst_size, int phases, const double* m, int stride, bool present) {
+        table.size = round_up(dst_size, panel_lines);
+        table.src_size = src_size;
+        table.taps = taps;
+        table.first.resize(table.size);
+        table.begin.assign(table.size, 0);
+        table.end.assign(table.size, taps);
+        table.weights.resize(static_cast<size_t>(table.size) * taps);
+        for (int o = 0; o < table.size; ++o) {
+
+            // Padding repeats the last output sample.
+            const int oc = std::min(o, dst_size - 1);
+            table.first[o] = sample_base(oc, src_size, dst_size) + 1 - bound;
+            for (int i = 0; i < taps; ++i) {
+                table.weights[static_cast<size_t>(o) * taps + i] = present ? static_cast<float>(m[static_cast<size_t>(oc % phases * taps + i) * stride]) : 0.0f;
+            }
+        }
+        sparsify_weight_table(table, 0.0f);
+        fold_weight_table(table);
+    };
+    double kept = 0.0;
+    for (int k = 0; k < rank; ++k) {
+        const bool present = k < cols;
+        const int j = present ? order[k] : 0;
+        create_table(table_y[k], src_height, dst_height, stencils.phases_y, a.data() + j, cols, present);
+        create_table(table_x[k], src_width, dst_width, stencils.phases_x, v.data() + j, cols, present);
+        if (present) {
+            kept += sigma[j] * sigma[j];
+        }
+    }
+
+    // Weight sum of each stencil's approximation.
+    norm.assign(static_cast<size_t>(stencils.phases_x) * stencils.phases_y, 0.0f);
+    for (int k = 0; k < std::min(rank, cols); ++k) {
+        const int j = order[k];
+        for (int py = 0; py < stencils.phases_y; ++py) {
+            double sum_y = 0.0;
+            for (int y = 0; y < taps; ++y) {
+                sum_y += a[static_cast<size_t>(py * taps + y) * cols + j];
+            }
+            for (int px = 0; px < stencils.phases_x; ++px) {
+                double sum_x = 0.0;
+                for (int x = 0; x < taps; ++x) {
+                    sum_x += v[static_cast<size_t>(px * taps + x) * cols + j];
+                }
+                norm[static_cast<size_t>(py) * stencils.phases_x + px] += static_cast<float>(sum_y * sum_x);
+            }
+        }
+    }
+
+    return std::sqrt(std::max(total - kept, 0.0) / total);
+}
+
+void union_stencil_ranges(const Stencil_table* const* tables, int n, std::vector<int>& begin, std::vector<int>& end)
+{
+    begin = tables[0]->begin;
+    end = tables[0]->end;
+    for (int b = 1; b < n; ++b) {
+        for (size_t i = 0; i < begin.size(); ++i) {
+            begin[i] = std::min(begin[i], tables[b]->begin[i]);
+            end[i] = std::max(end[i], tables[b]->end[i]);
+        }
+    }
+}
+
+void apply_stencil_table_scalar(const Plane& in, const Stencil_table* const* tables, int n, float ar, bool srgb, Plane* out)
+{
+    const Stencil_table& table = *tables[0];
+    const int taps = table.taps;
+    const int bound = taps / 2;
+    std::vector<int> begin;
+    std::vector<int> end;
+    union_stencil_ranges(tables, n, begin, end);
+
+    // Clamped colors of a row of taps next to the edges.
+    std::vector<float> colors(taps);
+
+    for (int oy = 0; oy < out[0].height; ++oy) {
+        const int base_y = sample_base(oy, in.height, out[0].height);
+        for (int ox = 0; ox < out[0].width; ++ox) {
+            const int base_x = sample_base(ox, in.width, out[0].width);
+            const size_t stencil = static_cast<size_t>(oy % table.phases_y) * table.phases_x + ox % table.phases_x;
+            float csum[max_batch] = {};
+            for (int y = 0; y < taps; ++y) {
+                const size_t r = stencil * taps + y;
+                if (begin[r] >= end[r]) {
+                    continue;
+                }
+                const float* row = in.data.data() + static_cast<size_t>(std::clamp(base_y + 1 - bound + y, 0, in.height - 1)) * in.pitch;
+                const int x0 = base_x + 1 - bound;
+                const float* color = colors.data();
+                if (x0 + begin[r] >= 0 && x0 + end[r] <= in.width) {
+                    color = row + x0;
+                }
+                else {
+                    for (int x = begin[r]; x < end[r]; ++x) {
+                        colors[x] = row[std::clamp(x0 + x, 0, in.width - 1)];
+                    }
+                }
+                for (int b = 0; b < n; ++b) {
+                    const float* w = &tables[b]->weights[r * taps];
+                    for (int x = begin[r]; x < end[r]; ++x) {
+                        csum[b] += color[x] * w[x];
+                    }
+                }
+            }
+
+            // Antiringing.
+            // The 2x2 taps nearest the sample give lo and hi.
+            float lo = 0.0f;
+            float hi = 0.0f;
+            if (ar > 0.0f) {
+                const int x0 = std::clamp(base_x, 0, in.width - 1);
+                const int x1 = std::clamp(base_x + 1, 0, in.width - 1);
+                const float* row0 = in.data.data() + static_cast<size_t>(std::clamp(base_y, 0, in.height - 1)) * in.pitch;
+                const float* row1 = in.data.data() + static_cast<size_t>(std::clamp(base_y + 1, 0, in.height - 1)) * in.pitch;
+                lo = std::min({ row0[x0], row0[x1], row1[x0], row1[x1] });
+                hi = std::max({ row0[x0], row0[x1], row1[x0], row1[x1] });
+            }
+
+            for (int b = 0; b < n; ++b) {
+                float result = csum[b];
+
+                // Antiringing.
+                if (ar > 0.0f) {
+                    result += (std::clamp(result, lo, hi) - result) * ar;
+                }
+
+                out[b].data[static_cast<size_t>(oy) * out[b].pitch + ox] = srgb ? linear_to_srgb(result) : result;
+            }
+        }
+    }
+}
+
+template <Isa isa>
+static void apply_stencil_table_vector(const Plane& in, const Stencil_table* const* tables, int n, float ar, bool srgb, Plane* out)
+{
+    const Stencil_table& table = *tables[0];
+    Stencil_view view;
+    view.in = view_plane(in);
+    for (int b = 0; b < n; ++b) {
+        view.out[b] = view_plane(out[b]);
+        view.weights[b] = tables[b]->weights.data();
+    }
+    view.n = n;
+    view.ar = ar;
+    view.srgb = srgb;
+    view.phases_x = table.phases_x;
+    view.phases_y = table.phases_y;
+    view.taps = table.taps;
+    std::vector<int> begin;
+    std::vector<int> end;
+    union_stencil_ranges(tables, n, begin, end);
+    view.begin = begin.data();
+    view.end = end.data();
+    std::vector<float> colors(table.taps);
+    view.colors = colors.data();
+    std::vector<int> base_x;
+    std::vector<int> base_y;
+    create_sample_positions(in.width, out[0].width, base_x, nullptr);
+    create_sample_positions(in.height, out[0].height, base_y, nullptr);
+    view.base_x = base_x.data();
+    view.base_y = base_y.data();
+    if constexpr (isa == ISA_AVX512) {
+        apply_stencil_table_avx512(view);
+    }
+    else {
+        apply_stencil_table_avx2(view);
+    }
+}
+
+Apply_stencil_table get_apply_stencil_table(Isa isa)
+{
+    switch (isa) {
+        case ISA_AVX512:
+            return apply_stencil_table_vector<ISA_AVX512>;
+        case ISA_AVX2:
+            return apply_stencil_table_vector<ISA_AVX2>;
+        default:
+            return apply_stencil_table_scalar;
+    }
+}
+
+// Resamples in with the tables of create_weight_table and pass, y axis first like the shader.
+static void resample_orthogonal(const Plane& in, Create_weight_table create_weight_table, Resample_pass pass, const Kernel_params& k, float ar, Plane& out)
+{
+    const float scale = static_cast<float>(out.width) / static_cast<float>(in.width);
+    Weight_table table_x;
+    Weight_table table_y;
+    create_weight_table(table_x, k, scale, in.width, out.width);
+    create_weight_table(table_y, k, scale, in.height, out.height);
+    fold_weight_table(table_x);
+    fold_weight_table(table_y);
+    const Weight_table* tables_x[] = { &table_x };
+    const Weight_table* tables_y[] = { &table_y };
+    std::vector<float> intermediate(static_cast<size_t>(table_y.size) * in.pitch);
+    const Lines lines = { intermediate.data(), static_cast<ptrdiff_t>(in.pitch) * panel_lines, panel_lines };
+    pass({ const_cast<float*>(in.data.data()), panel_lines, in.pitch }, in.pitch, tables_y, 1, ar, &lines, true);
+    const Lines dst = { out.data.data(), panel_lines, out.pitch };
+    pass(lines, table_y.size, tables_x, 1, ar, &dst, true);
+}
+
+bool check_resample()
+{
+    const Isa isa = detect_isa();
+    if (isa == ISA_SCALAR) {
+        return false;
+    }
+
+    // Integer ratios put output samples exactly on source samples, where a position one tap off shows up through antiringing.
+    // Blur, p1 and p2 of each kernel index.
+    const std::array<std::array<float, 3>, 12> params = { {
+        { 0.93f, 0.0f, 0.0f }, { 0.93f, 0.0f, 0.0f }, { 0.93f, 0.0f, 0.0f }, { 0.93f, 1.5f, 0.0f },
+        { 0.93f, 5.0f, 0.0f }, { 0.93f, 2.0f, 1.0f }, { 0.93f, 0.16f, 1.0f }, { 0.93f, 1.0f, 2.0f },
+        { 0.93f, 0.4f, 0.7f }, { 1.0f, -0.5f, 0.0f }, { 1.0f, 0.5f, 1.0f }, { 1.0f, 0.33f, 0.33f }
+    } };
+    const std::array<std::array<int, 4>, 3> sizes = { { { 70, 70, 210, 210 }, { 100, 70, 300, 210 }, { 210, 210, 70, 70 } } };
+    constexpr float ar = 1.0f;
+    constexpr double tolerance = 1e-4;
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    bool ok = true;
+    std::cout << "Resampling (" << isa_name(isa) << ") against the scalar path, antiringing " << ar << ", max abs. difference:\n";
+    std::cout << "kernel  size             orthogonal  cylindrical\n";
+    for (int kernel = 0; kernel < static_cast<int>(params.size()); ++kernel) {
+        const Kernel_params k = { kernel, 2.0f, params[kernel][0], params[kernel][1], params[kernel][2] };
+        for (const auto& size : sizes) {
+            Plane in;
+            create_plane(in, size[0], size[1]);
+            for (int y = 0; y < in.height; ++y) {
+                for (int x = 0; x < in.width; ++x) {
+                    in.data[static_cast<size_t>(y) * in.pitch + x] = uniform(rng);
+                }
+            }
+            std::array<Plane, 4> out;
+            for (auto& plane : out) {
+                create_plane(plane, size[2], size[3]);
+            }
+            resample_orthogonal(in, get_create_weight_table(ISA_SCALAR, kernel, true), get_resample_pass(ISA_SCALAR), k, ar, out[0]);
+            resample_orthogonal(in, get_create_weight_table(isa, kernel, true), get_resample_pass(isa), k, ar, out[1]);
+            const float scale = static_cast<float>(size[2]) / static_cast<float>(size[0]);
+            get_resample_cylindrical(ISA_SCALAR, kernel, true)(in, &k, 1, scale, ar, false, &out[2]);
+            get_resample_cylindrical(isa, kernel, true)(in, &k, 1, scale, ar, false, &out[3]);
+            std::array<double, 2> difference = {};
+            for (int i = 0; i < 2; ++i) {
+                for (size_t j = 0; j < out[2 * i].data.size(); ++j) {
+                    difference[i] = std::max(difference[i], static_cast<double>(std::abs(out[2 * i].data[j] - out[2 * i + 1].data[j])));
+                }
+                ok = ok && difference[i] <= tolerance;
+            }
+            std::cout << std::left << std::setw(8) << kernel << std::setw(17) << (std::to_string(size[0]) + "x" + std::to_string(size[1]) + "->" + std::to_string(size[2]) + "x" + std::to_string(size[3])) << std::right;
+            std::cout << std::scientific << std::setprecision(2) << std::setw(10) << difference[0] << std::setw(13) << difference[1] << "\n";
+        }
+    }
+    std::cout << std::defaultfloat;
+    std::cout << (ok ? "All within " : "Some above ") << tolerance << ".\n";
+    return ok;
+}
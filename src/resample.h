@@ -0,0 +1,393 @@
+#pragma once
+
+#include "common.h"
+#include "kernel_functions.h"
+#include "cpu_features.h"
+
+// CPU resampler.
+// Mirrors ps_resample_ortho.hlsl and ps_resample_cyl.hlsl, including clamp addressing and antiringing.
+
+// Lines are processed in panels of this many lanes, one lane per line.
+// It's the AVX-512 width, AVX2 handles a panel as two halves.
+inline constexpr int panel_lines = 16;
+
+// Most parameter sets resampled in one traversal of the source.
+inline constexpr int max_batch = 8;
+
+inline int round_up(int x, int multiple)
+{
+    return (x + multiple - 1) / multiple * multiple;
+}
+
+// Row-major float image.
+// Pitch and the allocated row count are padded to panel_lines.
+struct Plane
+{
+    int width;
+    int height;
+    int pitch;
+    std::vector<float> data;
+};
+
+void create_plane(Plane& plane, int width, int height);
+
+// Strided view of an image as a set of lines that get resampled along their positions.
+// Element (line, pos) is at data[line / panel_lines * panel + pos * step + line % panel_lines].
+// A row-major plane viewed as columns is {data, panel_lines, pitch}.
+// If half is set the lines are stored as half floats there instead, with the same layout.
+// If srgb is set linear values are stored as sRGB, the delinearize pass fused into the last resample pass.
+struct Lines
+{
+    float* data;
+    ptrdiff_t panel;
+    ptrdiff_t step;
+    uint16_t* half = nullptr;
+    bool srgb = false;
+};
+
+// From linear to sRGB, same as ps_delinearize.hlsl.
+// Vectors get the polynomials of simd_math::pow().
+template <typename T>
+inline T linear_to_srgb(T c)
+{
+    return select(c < 0.0031308, 12.92 * c, 1.055 * simd_math::pow(c, 1.0 / 2.4) - 0.055);
+}
+
+inline float linear_to_srgb(float c)
+{
+    return static_cast<float>(linear_to_srgb(static_cast<double>(c)));
+}
+
+// Element type and storage of lines, so passes can be instantiated for float and half float.
+template <bool half>
+using Element = std::conditional_t<half, uint16_t, float>;
+
+template <bool half>
+inline Element<half>* elements(const Lines& lines)
+{
+    if constexpr (half) {
+        return lines.half;
+    }
+    else {
+        return lines.data;
+    }
+}
+
+// IEEE half float conversions with round to nearest even, for the scalar pass.
+// The vector passes convert with F16C.
+inline uint16_t float_to_half(float f)
+{
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    const uint16_t sign = static_cast<uint16_t>((x >> 16) & 0x8000);
+    x &= 0x7fffffff;
+
+    // Inf and NaN.
+    if (x >= 0x7f800000) {
+        return static_cast<uint16_t>(sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0));
+    }
+
+    // Rounds to inf.
+    if (x >= 0x477ff000) {
+        return static_cast<uint16_t>(sign | 0x7c00);
+    }
+
+    // Denormal or zero, in units of 2^-24.
+    if (x < 0x38800000) {
+        float a;
+        std::memcpy(&a, &x, sizeof(a));
+        return static_cast<uint16_t>(sign | static_cast<uint16_t>(std::nearbyint(a * 16777216.0f)));
+    }
+
+    // Rebias the exponent and round the dropped 13 bits.
+    x += 0xc8000fff + ((x >> 13) & 1);
+    return static_cast<uint16_t>(sign | (x >> 13));
+}
+
+inline float half_to_float(uint16_t h)
+{
+    const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    const uint32_t exponent = (h >> 10) & 0x1f;
+    const uint32_t mantissa = h & 0x3ff;
+    uint32_t x;
+    if (exponent == 0) {
+        const float a = mantissa / 16777216.0f;
+        std::memcpy(&x, &a, sizeof(x));
+        x |= sign;
+    }
+    else if (exponent == 31) {
+        x = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else {
+        x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+inline float to_float(float x)
+{
+    return x;
+}
+
+inline float to_float(uint16_t x)
+{
+    return half_to_float(x);
+}
+
+inline void store_element(float* p, float x)
+{
+    *p = x;
+}
+
+inline void store_element(uint16_t* p, float x)
+{
+    *p = float_to_half(x);
+}
+
+// Normalized weights of every output sample along one axis.
+struct Weight_table
+{
+    // Output samples, padded to panel_lines.
+    int size;
+
+    // Source samples, taps are clamped to [0, src_size - 1].
+    int src_size;
+
+    // Taps per output sample, 2 * bound.
+    int taps;
+
+    // First source index of each output sample, unclamped.
+    std::vector<int> first;
+
+    // Range of taps with nonzero weight of each output sample, [begin, end).
+    // Weights outside of it are 0, see sparsify_weight_table().
+    std::vector<int> begin;
+    std::vector<int> end;
+
+    std::vector<float> weights;
+};
+
+// Same sample positions as the orthogonal shader, (o + 0.5) * src_size / dst_size.
+using Create_weight_table = void (*)(Weight_table& table, const Kernel_params& k, float scale, int src_size, int dst_size);
+
+// Instantiated for the kernel index.
+// Vector ISAs evaluate the kernel with simd_math.h, precise picks its accuracy tier.
+Create_weight_table get_create_weight_table(Isa isa, int kernel, bool precise);
+
+// Trims the taps at both ends of each output sample whose weight is not above epsilon, zeroes them and renormalizes.
+// Taps nearest the sample are always kept, antiringing needs them.
+// With epsilon 0 only exact zeros are dropped and the weights stay as they are.
+void sparsify_weight_table(Weight_table& table, float epsilon);
+
+// Moves the weights of taps outside of the source onto the edge sample they clamp to and trims them,
+// so the passes read [begin, end) without clamping. The range still holds the taps antiringing reads, see antiringing_taps().
+// Every table has to be folded before it's resampled with.
+void fold_weight_table(Weight_table& table);
+
+// Averages the outputs of a folded table over the boxes of ImageMetrics::SubSample() of factor, including its shift for even factors and Reflect() at the edge.
+// Resampling with it gives the subsampled grid, dst_size / factor samples, without the full one.
+// Same result as subsampling afterwards only if nothing non-linear comes in between, the table can't be used with antiringing.
+void create_box_weight_table(Weight_table& box, const Weight_table& table, int dst_size, int factor);
+
+// Rows [begin, begin + size) of table, both multiples of panel_lines, to resample a band of the output.
+void slice_weight_table(const Weight_table& table, int begin, int size, Weight_table& slice);
+
+// Taps nearest the sample of output o (i = 0 and i = 1 in the shader), clamped to the source like the sampler does.
+inline void antiringing_taps(const Weight_table& table, int o, int& i0, int& i1)
+{
+    const int bound = table.taps / 2;
+    i0 = std::clamp(bound - 1, -table.first[o], table.src_size - 1 - table.first[o]);
+    i1 = std::clamp(bound, -table.first[o], table.src_size - 1 - table.first[o]);
+}
+
+// Resamples all lines of in along their positions, once for each of the n tables.
+// Only the union of the tables' tap ranges is visited, the tables have to be folded so no tap is clamped.
+// The tables have to share first and taps (same radius and scale), every source tap is loaded once and applied to all of them.
+// Output element (line, o) goes to (line, o) of out[b], or to (o, line) if transpose is set,
+// so the next pass can read the other axis as lines.
+// Antiringing is applied if ar > 0.
+// Either in or all of out can be stored as half floats.
+using Resample_pass = void (*)(Lines in, int lines, const Weight_table* const* tables, int n, float ar, const Lines* out, bool transpose);
+
+void resample_pass_scalar(Lines in, int lines, const Weight_table* const* tables, int n, float ar, const Lines* out, bool transpose);
+
+Resample_pass get_resample_pass(Isa isa);
+
+// Copies a row-major plane into panels of panel_lines rows, each stored column by column.
+// Viewed as rows it's {data, pitch * panel_lines, panel_lines}.
+void block_rows(const Plane& in, std::vector<float>& out);
+
+// Resamples n parameter sets of the same radius in one traversal of the source.
+// If srgb is set the results are stored as sRGB, see Lines.
+using Resample_cylindrical = void (*)(const Plane& in, const Kernel_params* k, int n, float scale, float ar, bool srgb, Plane* out);
+
+// Instantiated for the kernel index, same as get_create_weight_table().
+Resample_cylindrical get_resample_cylindrical(Isa isa, int kernel, bool precise);
+
+// Exact floor(pos - 0.5) of pos = (o + 0.5) * src_size / dst_size and pos - base - 0.5.
+inline int sample_base(int o, int src_size, int dst_size)
+{
+    const long long num = static_cast<long long>(2 * o + 1) * src_size - dst_size;
+    const long long den = 2LL * dst_size;
+    return static_cast<int>(num >= 0 ? num / den : -((den - 1 - num) / den));
+}
+
+inline double sample_fraction(int o, int src_size, int dst_size)
+{
+    const long long num = static_cast<long long>(2 * o + 1) * src_size - dst_size;
+    const long long den = 2LL * dst_size;
+    return static_cast<double>(num - den * sample_base(o, src_size, dst_size)) / static_cast<double>(den);
+}
+
+// Normalized 2D weights of cylindrical resampling.
+// The ratio src_size / dst_size of each axis is rational, so output pixels with the same phase (ox % phases_x, oy % phases_y)
+// sample the source at the same fraction and share one stencil.
+struct Stencil_table
+{
+    // Output period of each axis, dst_size / gcd(src_size, dst_size).
+    int phases_x;
+    int phases_y;
+
+    // Taps per axis, 2 * bound.
+    int taps;
+
+    // Range of taps with nonzero weight of each stencil row, [begin, end), the kernel's disk.
+    // Rows outside of it have begin == end.
+    std::vector<int> begin;
+    std::vector<int> end;
+
+    // Stencil (px, py) starts at (py * phases_x + px) * taps * taps, rows of taps.
+    std::vector<float> weights;
+};
+
+// Stencils for every phase of in -> out.
+// Evaluated in double on the scalar path, there are at most as many stencils as output pixels.
+using Create_stencil_table = void (*)(Stencil_table& table, const Kernel_params& k, float scale, int src_width, int src_height, int dst_width, int dst_height);
+
+Create_stencil_table get_create_stencil_table(int kernel);
+
+// Stencils are worth it if they get reused and fit in memory.
+bool use_stencil_table(const Kernel_params& k, float scale, int src_width, int src_height, int dst_width, int dst_height);
+
+// Resamples n parameter sets of the same radius with their stencils, dot products over the source neighborhood.
+// Same results as Resample_cylindrical up to float rounding.
+using Apply_stencil_table = void (*)(const Plane& in, const Stencil_table* const* tables, int n, float ar, bool srgb, Plane* out);
+
+// Approximates the stencils by a sum of rank separable terms, x_k(ox, x) * y_k(oy, y), from an SVD of all of them.
+// Rows of the decomposed matrix are (phase_y, y), columns (phase_x, x).
+// Term k resamples like an orthogonal pass with table_x[k] and table_y[k], without antiringing.
+// norm gets the weight sum of the terms for each stencil, the sum of the terms has to be divided by it.
+// Returns the relative Frobenius norm of the dropped terms.
+// Its SVD is only cheap enough with few phases and taps.
+bool use_separable_approximation(const Kernel_params& k, float scale, int src_width, int src_height, int dst_width, int dst_height);
+
+double create_separable_approximation(const Stencil_table& stencils, int rank, int src_width, int src_height, int dst_width, int dst_height, Weight_table* table_x, Weight_table* table_y, std::vector<float>& norm);
+
+// Union of the tables' row ranges, only taps in it are visited.
+void union_stencil_ranges(const Stencil_table* const* tables, int n, std::vector<int>& begin, std::vector<int>& end);
+
+void apply_stencil_table_scalar(const Plane& in, const Stencil_table* const* tables, int n, float ar, bool srgb, Plane* out);
+
+Apply_stencil_table get_apply_stencil_table(Isa isa);
+
+// Entry points of the ISA translation units, resample_avx2.cpp and resample_avx512.cpp.
+// They're compiled with /arch, and inline code they instantiate, like std::vector's members or the helpers above, would be a COMDAT
+// the linker can pick for every other caller too. So the vector versions above allocate and compute sample positions here
+// and hand them raw views, and resample_simd.h only uses helpers of its own with internal linkage.
+
+struct Plane_view
+{
+    int width;
+    int height;
+    int pitch;
+    float* data;
+};
+
+// Weight_table without its vectors.
+struct Weight_table_view
+{
+    int size;
+    int src_size;
+    int taps;
+    const int* first;
+    const int* begin;
+    const int* end;
+    const float* weights;
+};
+
+// Kernel values at the n distances of x in place, n is a multiple of panel_lines.
+// Plugins are evaluated by the plugin, batched, so they don't have one.
+using Evaluate_kernel = void (*)(const Kernel_params& k, float* x, int n);
+
+Evaluate_kernel get_evaluate_kernel_avx2(int kernel, bool precise);
+Evaluate_kernel get_evaluate_kernel_avx512(int kernel, bool precise);
+
+// The tables are n views, otherwise same as Resample_pass.
+void resample_pass_avx2(Lines in, int lines, const Weight_table_view* tables, int n, float ar, const Lines* out, bool transpose);
+void resample_pass_avx512(Lines in, int lines, const Weight_table_view* tables, int n, float ar, const Lines* out, bool transpose);
+
+// Resample_cylindrical with the sample positions of every row and column and the tap offsets of a row computed.
+struct Cylindrical_view
+{
+    Plane_view in;
+    Plane_view out[max_batch];
+    const Kernel_params* k;
+    int n;
+    float s;
+    float ar;
+    bool srgb;
+    int bound;
+
+    // Taps of a row padded to the lanes, offsets are far outside of any radius there.
+    int row_taps;
+    const float* offsets;
+
+    // Scratch for a row of taps next to the edges, row_taps long, the padding is 0.
+    float* colors;
+
+    // sample_base() and sample_fraction() of every output column and row.
+    const int* base_x;
+    const double* fx;
+    const int* base_y;
+    const double* fy;
+};
+
+using Resample_cylindrical_view = void (*)(const Cylindrical_view& view);
+
+Resample_cylindrical_view get_resample_cylindrical_avx2(int kernel, bool precise);
+Resample_cylindrical_view get_resample_cylindrical_avx512(int kernel, bool precise);
+
+// Apply_stencil_table with the union of the row ranges and the sample positions computed.
+struct Stencil_view
+{
+    Plane_view in;
+    Plane_view out[max_batch];
+    const float* weights[max_batch];
+    int n;
+    float ar;
+    bool srgb;
+    int phases_x;
+    int phases_y;
+    int taps;
+
+    // See union_stencil_ranges().
+    const int* begin;
+    const int* end;
+
+    // Scratch for a row of taps next to the edges, taps long.
+    float* colors;
+
+    // sample_base() of every output column and row.
+    const int* base_x;
+    const int* base_y;
+};
+
+void apply_stencil_table_avx2(const Stencil_view& view);
+void apply_stencil_table_avx512(const Stencil_view& view);
+
+// Prints how far orthogonal and cylindrical resampling of the vector ISA are from the scalar path,
+// at integer ratios with antiringing, for every built-in kernel.
+// Returns false if the CPU has no vector ISA or they differ by more than float rounding and the accuracy of simd_math.h.
+bool check_resample();
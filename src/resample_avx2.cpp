@@ -0,0 +1,268 @@
+#include "resample_simd.h"
+
+#include <immintrin.h>
+
+// Compiled with /arch:AVX2, only called if detect_isa() reports AVX2.
+
+namespace
+{
+    // Transposes 8 rows of 8 floats in place.
+    inline void transpose8(__m256 r[8])
+    {
+        const __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+        const __m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+        const __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+        const __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+        const __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+        const __m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+        const __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+        const __m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+        const __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+        r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+        r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+        r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+        r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+        r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+        r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+        r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+        r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+    }
+
+    inline __m256 load8(const float* p)
+    {
+        return _mm256_loadu_ps(p);
+    }
+
+    inline __m256 load8(const uint16_t* p)
+    {
+        return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    }
+
+    inline void store8(float* p, __m256 v)
+    {
+        _mm256_storeu_ps(p, v);
+    }
+
+    inline void store8(uint16_t* p, __m256 v)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+    }
+
+    // lerp(c, clamp(c, lo, hi), ar)
+    inline __m256 antiring(__m256 c, __m256 lo, __m256 hi, __m256 ar)
+    {
+        const __m256 clamped = _mm256_min_ps(_mm256_max_ps(c, lo), hi);
+        return _mm256_fmadd_ps(_mm256_sub_ps(clamped, c), ar, c);
+    }
+
+    template <int n, bool antiringing, bool half_in, bool half_out>
+    void resample_lines(Lines in, int lines, const Weight_table_view* tables, float ar, const Lines* out, bool transpose)
+    {
+        const Weight_table_view& table = tables[0];
+        const __m256 ar_v = _mm256_set1_ps(ar);
+        alignas(32) float tile[n][panel_lines][panel_lines];
+        for (int l0 = 0; l0 < lines; l0 += panel_lines) {
+            const Element<half_in>* src = line_elements<half_in>(in) + l0 / panel_lines * in.panel;
+            for (int o0 = 0; o0 < table.size; o0 += panel_lines) {
+                for (int o = o0; o < o0 + panel_lines; ++o) {
+                    const float* w[n];
+                    for (int b = 0; b < n; ++b) {
+                        w[b] = tables[b].weights + static_cast<size_t>(o) * table.taps;
+                    }
+                    const int first = table.first[o];
+
+                    // Taps outside of every table's range have zero weight.
+                    int begin = table.begin[o];
+                    int end = table.end[o];
+                    for (int b = 1; b < n; ++b) {
+                        begin = min_value(begin, tables[b].begin[o]);
+                        end = max_value(end, tables[b].end[o]);
+                    }
+
+                    __m256 csum0[n];
+                    __m256 csum1[n];
+                    for (int b = 0; b < n; ++b) {
+                        csum0[b] = _mm256_setzero_ps();
+                        csum1[b] = _mm256_setzero_ps();
+                    }
+                    __m256 color0;
+                    __m256 color1;
+                    auto tap = [&](int i) {
+                        const Element<half_in>* color = src + (first + i) * in.step;
+                        color0 = load8(color);
+                        color1 = load8(color + 8);
+                        for (int b = 0; b < n; ++b) {
+                            const __m256 weight = _mm256_broadcast_ss(w[b] + i);
+                            csum0[b] = _mm256_fmadd_ps(color0, weight, csum0[b]);
+                            csum1[b] = _mm256_fmadd_ps(color1, weight, csum1[b]);
+                        }
+                    };
+
+                    // Antiringing.
+                    // The two taps nearest the sample (i = 0 and i = 1 in the shader) give lo and hi,
+                    // they're taken from the same loads that accumulate them.
+                    // Next to the edges both can clamp to the same sample.
+                    if constexpr (antiringing) {
+                        int i0;
+                        int i1;
+                        view_antiringing_taps(table, o, i0, i1);
+                        for (int i = begin; i < i0; ++i) {
+                            tap(i);
+                        }
+                        tap(i0);
+                        __m256 lo0 = color0;
+                        __m256 lo1 = color1;
+                        if (i1 > i0) {
+                            tap(i1);
+                        }
+                        const __m256 hi0 = _mm256_max_ps(lo0, color0);
+                        const __m256 hi1 = _mm256_max_ps(lo1, color1);
+                        lo0 = _mm256_min_ps(lo0, color0);
+                        lo1 = _mm256_min_ps(lo1, color1);
+                        for (int i = i1 + 1; i < end; ++i) {
+                            tap(i);
+                        }
+                        for (int b = 0; b < n; ++b) {
+                            csum0[b] = antiring(csum0[b], lo0, hi0, ar_v);
+                            csum1[b] = antiring(csum1[b], lo1, hi1, ar_v);
+                        }
+                    }
+                    else {
+                        for (int i = begin; i < end; ++i) {
+                            tap(i);
+                        }
+                    }
+
+                    for (int b = 0; b < n; ++b) {
+                        if (out[b].srgb) {
+                            csum0[b] = linear_to_srgb(Vec_avx2<true>(csum0[b])).v;
+                            csum1[b] = linear_to_srgb(Vec_avx2<true>(csum1[b])).v;
+                        }
+                        if (transpose) {
+                            _mm256_store_ps(tile[b][o - o0], csum0[b]);
+                            _mm256_store_ps(tile[b][o - o0] + 8, csum1[b]);
+                        }
+                        else {
+                            Element<half_out>* dst = line_elements<half_out>(out[b]) + l0 / panel_lines * out[b].panel + o * out[b].step;
+                            store8(dst, csum0[b]);
+                            store8(dst + 8, csum1[b]);
+                        }
+                    }
+                }
+
+                // Write the tiles back as 8x8 blocks, lines become positions.
+                if (transpose) {
+                    for (int b = 0; b < n; ++b) {
+                        Element<half_out>* dst = line_elements<half_out>(out[b]) + o0 / panel_lines * out[b].panel + l0 * out[b].step;
+                        for (int ob = 0; ob < panel_lines; ob += 8) {
+                            for (int lb = 0; lb < panel_lines; lb += 8) {
+                                __m256 r[8];
+                                for (int j = 0; j < 8; ++j) {
+                                    r[j] = _mm256_load_ps(tile[b][ob + j] + lb);
+                                }
+                                transpose8(r);
+                                for (int j = 0; j < 8; ++j) {
+                                    store8(dst + (lb + j) * out[b].step + ob, r[j]);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    template <int n, bool half_in, bool half_out>
+    void resample_pass(Lines in, int lines, const Weight_table_view* tables, float ar, const Lines* out, bool transpose)
+    {
+        if (ar > 0.0f) {
+            resample_lines<n, true, half_in, half_out>(in, lines, tables, ar, out, transpose);
+        }
+        else {
+            resample_lines<n, false, half_in, half_out>(in, lines, tables, ar, out, transpose);
+        }
+    }
+
+    template <int n>
+    void resample_pass(Lines in, int lines, const Weight_table_view* tables, float ar, const Lines* out, bool transpose)
+    {
+        if (in.half) {
+            resample_pass<n, true, false>(in, lines, tables, ar, out, transpose);
+        }
+        else if (out[0].half) {
+            resample_pass<n, false, true>(in, lines, tables, ar, out, transpose);
+        }
+        else {
+            resample_pass<n, false, false>(in, lines, tables, ar, out, transpose);
+        }
+    }
+}
+
+void resample_pass_avx2(Lines in, int lines, const Weight_table_view* tables, int n, float ar, const Lines* out, bool transpose)
+{
+    switch (n) {
+        case 1:
+            return resample_pass<1>(in, lines, tables, ar, out, transpose);
+        case 2:
+            return resample_pass<2>(in, lines, tables, ar, out, transpose);
+        case 3:
+            return resample_pass<3>(in, lines, tables, ar, out, transpose);
+        case 4:
+            return resample_pass<4>(in, lines, tables, ar, out, transpose);
+        case 5:
+            return resample_pass<5>(in, lines, tables, ar, out, transpose);
+        case 6:
+            return resample_pass<6>(in, lines, tables, ar, out, transpose);
+        case 7:
+            return resample_pass<7>(in, lines, tables, ar, out, transpose);
+        case 8:
+            return resample_pass<8>(in, lines, tables, ar, out, transpose);
+    }
+}
+
+// Stencils need no kernel evaluation, so there is no accuracy tier.
+void apply_stencil_table_avx2(const Stencil_view& view)
+{
+    apply_stencil_table_simd<Vec_avx2<true>>(view);
+}
+
+Evaluate_kernel get_evaluate_kernel_avx2(int kernel, bool precise)
+{
+    if (precise) {
+        return select_kernel<false, Simd_instances<Vec_avx2<true>>::Evaluate_kernel_instance>(kernel);
+    }
+    return select_kernel<false, Simd_instances<Vec_avx2<false>>::Evaluate_kernel_instance>(kernel);
+}
+
+Resample_cylindrical_view get_resample_cylindrical_avx2(int kernel, bool precise)
+{
+    if (precise) {
+        return select_kernel<true, Simd_instances<Vec_avx2<true>>::Resample_cylindrical_instance>(kernel);
+    }
+    return select_kernel<true, Simd_instances<Vec_avx2<false>>::Resample_cylindrical_instance>(kernel);
+}
+
+Evaluate_expression get_evaluate_expression_avx2(bool precise)
+{
+    if (precise) {
+        return evaluate_expression_simd<Vec_avx2<true>>;
+    }
+    return evaluate_expression_simd<Vec_avx2<false>>;
+}
+
+void evaluate_math_avx2(int function, bool precise, const float* x, const float* y, float* out, int n)
+{
+    if (precise) {
+        evaluate_math_simd<Vec_avx2<true>>(function, x, y, out, n);
+    }
+    else {
+        evaluate_math_simd<Vec_avx2<false>>(function, x, y, out, n);
+    }
+}
@@ -0,0 +1,239 @@
+#include "resample_simd.h"
+
+#include <immintrin.h>
+
+// Compiled with /arch:AVX512, only called if detect_isa() reports AVX-512.
+
+namespace
+{
+    // Transposes 16 rows of 16 floats in place.
+    inline void transpose16(__m512 r[16])
+    {
+        __m512 t[16];
+        for (int i = 0; i < 16; i += 2) {
+            t[i] = _mm512_unpacklo_ps(r[i], r[i + 1]);
+            t[i + 1] = _mm512_unpackhi_ps(r[i], r[i + 1]);
+        }
+        for (int i = 0; i < 16; i += 4) {
+            r[i] = _mm512_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(1, 0, 1, 0));
+            r[i + 1] = _mm512_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(3, 2, 3, 2));
+            r[i + 2] = _mm512_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(1, 0, 1, 0));
+            r[i + 3] = _mm512_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(3, 2, 3, 2));
+        }
+        for (int i = 0; i < 16; i += 8) {
+            for (int j = 0; j < 4; ++j) {
+                t[i + j] = _mm512_shuffle_f32x4(r[i + j], r[i + j + 4], 0x88);
+                t[i + j + 4] = _mm512_shuffle_f32x4(r[i + j], r[i + j + 4], 0xdd);
+            }
+        }
+        for (int j = 0; j < 8; ++j) {
+            r[j] = _mm512_shuffle_f32x4(t[j], t[j + 8], 0x88);
+            r[j + 8] = _mm512_shuffle_f32x4(t[j], t[j + 8], 0xdd);
+        }
+    }
+
+    inline __m512 load16(const float* p)
+    {
+        return _mm512_loadu_ps(p);
+    }
+
+    inline __m512 load16(const uint16_t* p)
+    {
+        return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+    }
+
+    inline void store16(float* p, __m512 v)
+    {
+        _mm512_storeu_ps(p, v);
+    }
+
+    inline void store16(uint16_t* p, __m512 v)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm512_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+    }
+
+    // lerp(c, clamp(c, lo, hi), ar)
+    inline __m512 antiring(__m512 c, __m512 lo, __m512 hi, __m512 ar)
+    {
+        const __m512 clamped = _mm512_min_ps(_mm512_max_ps(c, lo), hi);
+        return _mm512_fmadd_ps(_mm512_sub_ps(clamped, c), ar, c);
+    }
+
+    template <int n, bool antiringing, bool half_in, bool half_out>
+    void resample_lines(Lines in, int lines, const Weight_table_view* tables, float ar, const Lines* out, bool transpose)
+    {
+        const Weight_table_view& table = tables[0];
+        const __m512 ar_v = _mm512_set1_ps(ar);
+        for (int l0 = 0; l0 < lines; l0 += panel_lines) {
+            const Element<half_in>* src = line_elements<half_in>(in) + l0 / panel_lines * in.panel;
+            for (int o0 = 0; o0 < table.size; o0 += panel_lines) {
+                __m512 tile[n][panel_lines];
+                for (int o = o0; o < o0 + panel_lines; ++o) {
+                    const float* w[n];
+                    for (int b = 0; b < n; ++b) {
+                        w[b] = tables[b].weights + static_cast<size_t>(o) * table.taps;
+                    }
+                    const int first = table.first[o];
+
+                    // Taps outside of every table's range have zero weight.
+                    int begin = table.begin[o];
+                    int end = table.end[o];
+                    for (int b = 1; b < n; ++b) {
+                        begin = min_value(begin, tables[b].begin[o]);
+                        end = max_value(end, tables[b].end[o]);
+                    }
+
+                    __m512 csum[n];
+                    for (int b = 0; b < n; ++b) {
+                        csum[b] = _mm512_setzero_ps();
+                    }
+                    auto tap = [&](int i) {
+                        const __m512 color = load16(src + (first + i) * in.step);
+                        for (int b = 0; b < n; ++b) {
+                            csum[b] = _mm512_fmadd_ps(color, _mm512_set1_ps(w[b][i]), csum[b]);
+                        }
+                        return color;
+                    };
+
+                    // Antiringing.
+                    // The two taps nearest the sample (i = 0 and i = 1 in the shader) give lo and hi,
+                    // they're taken from the same loads that accumulate them.
+                    // Next to the edges both can clamp to the same sample.
+                    if constexpr (antiringing) {
+                        int i0;
+                        int i1;
+                        view_antiringing_taps(table, o, i0, i1);
+                        for (int i = begin; i < i0; ++i) {
+                            tap(i);
+                        }
+                        const __m512 c0 = tap(i0);
+                        const __m512 c1 = i1 > i0 ? tap(i1) : c0;
+                        const __m512 lo = _mm512_min_ps(c0, c1);
+                        const __m512 hi = _mm512_max_ps(c0, c1);
+                        for (int i = i1 + 1; i < end; ++i) {
+                            tap(i);
+                        }
+                        for (int b = 0; b < n; ++b) {
+                            csum[b] = antiring(csum[b], lo, hi, ar_v);
+                        }
+                    }
+                    else {
+                        for (int i = begin; i < end; ++i) {
+                            tap(i);
+                        }
+                    }
+
+                    for (int b = 0; b < n; ++b) {
+                        if (out[b].srgb) {
+                            csum[b] = linear_to_srgb(Vec_avx512<true>(csum[b])).v;
+                        }
+                        if (transpose) {
+                            tile[b][o - o0] = csum[b];
+                        }
+                        else {
+                            store16(line_elements<half_out>(out[b]) + l0 / panel_lines * out[b].panel + o * out[b].step, csum[b]);
+                        }
+                    }
+                }
+
+                // Write the tiles back, lines become positions.
+                if (transpose) {
+                    for (int b = 0; b < n; ++b) {
+                        transpose16(tile[b]);
+                        Element<half_out>* dst = line_elements<half_out>(out[b]) + o0 / panel_lines * out[b].panel + l0 * out[b].step;
+                        for (int j = 0; j < panel_lines; ++j) {
+                            store16(dst + j * out[b].step, tile[b][j]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    template <int n, bool half_in, bool half_out>
+    void resample_pass(Lines in, int lines, const Weight_table_view* tables, float ar, const Lines* out, bool transpose)
+    {
+        if (ar > 0.0f) {
+            resample_lines<n, true, half_in, half_out>(in, lines, tables, ar, out, transpose);
+        }
+        else {
+            resample_lines<n, false, half_in, half_out>(in, lines, tables, ar, out, transpose);
+        }
+    }
+
+    template <int n>
+    void resample_pass(Lines in, int lines, const Weight_table_view* tables, float ar, const Lines* out, bool transpose)
+    {
+        if (in.half) {
+            resample_pass<n, true, false>(in, lines, tables, ar, out, transpose);
+        }
+        else if (out[0].half) {
+            resample_pass<n, false, true>(in, lines, tables, ar, out, transpose);
+        }
+        else {
+            resample_pass<n, false, false>(in, lines, tables, ar, out, transpose);
+        }
+    }
+}
+
+void resample_pass_avx512(Lines in, int lines, const Weight_table_view* tables, int n, float ar, const Lines* out, bool transpose)
+{
+    switch (n) {
+        case 1:
+            return resample_pass<1>(in, lines, tables, ar, out, transpose);
+        case 2:
+            return resample_pass<2>(in, lines, tables, ar, out, transpose);
+        case 3:
+            return resample_pass<3>(in, lines, tables, ar, out, transpose);
+        case 4:
+            return resample_pass<4>(in, lines, tables, ar, out, transpose);
+        case 5:
+            return resample_pass<5>(in, lines, tables, ar, out, transpose);
+        case 6:
+            return resample_pass<6>(in, lines, tables, ar, out, transpose);
+        case 7:
+            return resample_pass<7>(in, lines, tables, ar, out, transpose);
+        case 8:
+            return resample_pass<8>(in, lines, tables, ar, out, transpose);
+    }
+}
+
+// Stencils need no kernel evaluation, so there is no accuracy tier.
+void apply_stencil_table_avx512(const Stencil_view& view)
+{
+    apply_stencil_table_simd<Vec_avx512<true>>(view);
+}
+
+Evaluate_kernel get_evaluate_kernel_avx512(int kernel, bool precise)
+{
+    if (precise) {
+        return select_kernel<false, Simd_instances<Vec_avx512<true>>::Evaluate_kernel_instance>(kernel);
+    }
+    return select_kernel<false, Simd_instances<Vec_avx512<false>>::Evaluate_kernel_instance>(kernel);
+}
+
+Resample_cylindrical_view get_resample_cylindrical_avx512(int kernel, bool precise)
+{
+    if (precise) {
+        return select_kernel<true, Simd_instances<Vec_avx512<true>>::Resample_cylindrical_instance>(kernel);
+    }
+    return select_kernel<true, Simd_instances<Vec_avx512<false>>::Resample_cylindrical_instance>(kernel);
+}
+
+Evaluate_expression get_evaluate_expression_avx512(bool precise)
+{
+    if (precise) {
+        return evaluate_expression_simd<Vec_avx512<true>>;
+    }
+    return evaluate_expression_simd<Vec_avx512<false>>;
+}
+
+void evaluate_math_avx512(int function, bool precise, const float* x, const float* y, float* out, int n)
+{
+    if (precise) {
+        evaluate_math_simd<Vec_avx512<true>>(function, x, y, out, n);
+    }
+    else {
+        evaluate_math_simd<Vec_avx512<false>>(function, x, y, out, n);
+    }
+}
@@ -0,0 +1,375 @@
+#pragma once
+
+#include "common.h"
+#include "resample.h"
+#include "simd_math.h"
+#include "kernel_expression.h"
+
+// Kernels, cylindrical resampling, stencils and expressions evaluated V::lanes taps at a time.
+// Included by the ISA translation units, which instantiate it for their vector type.
+// Same results as the scalar versions in resample.cpp, up to float rounding and the accuracy of simd_math.h.
+
+// Everything here has internal linkage, see the entry points in resample.h.
+// It doesn't call std::min() and the like or members of std::vector either, those would be instantiated with /arch and shared.
+namespace
+{
+    template <typename T>
+    inline T min_value(T a, T b)
+    {
+        return b < a ? b : a;
+    }
+
+    template <typename T>
+    inline T max_value(T a, T b)
+    {
+        return a < b ? b : a;
+    }
+
+    template <typename T>
+    inline T clamp_value(T x, T lo, T hi)
+    {
+        return min_value(max_value(x, lo), hi);
+    }
+
+    template <bool half>
+    inline Element<half>* line_elements(const Lines& lines)
+    {
+        if constexpr (half) {
+            return lines.half;
+        }
+        else {
+            return lines.data;
+        }
+    }
+
+    // Same as antiringing_taps().
+    inline void view_antiringing_taps(const Weight_table_view& table, int o, int& i0, int& i1)
+    {
+        const int bound = table.taps / 2;
+        i0 = clamp_value(bound - 1, -table.first[o], table.src_size - 1 - table.first[o]);
+        i1 = clamp_value(bound, -table.first[o], table.src_size - 1 - table.first[o]);
+    }
+
+    // The functor of k without its constructor, which is shared with the other translation units.
+    template <typename Kernel>
+    inline Kernel make_kernel(const Kernel_params& k)
+    {
+        Kernel kernel;
+        kernel.radius = k.radius;
+        kernel.blur = k.blur;
+        kernel.p1 = k.p1;
+        kernel.p2 = k.p2;
+        if constexpr (Kernel::batched) {
+            kernel.params = { k.radius, k.blur, k.p1, k.p2 };
+        }
+        return kernel;
+    }
+
+    // Converts row y of plane from linear to sRGB, V::lanes pixels at a time, the pitch covers the last vector.
+    template <typename V>
+    void linear_to_srgb_row(const Plane_view& plane, int y)
+    {
+        float* row = plane.data + static_cast<size_t>(y) * plane.pitch;
+        for (int x = 0; x < plane.width; x += V::lanes) {
+            linear_to_srgb(V::load(row + x)).store(row + x);
+        }
+    }
+
+    template <typename V, typename Kernel>
+    void evaluate_kernel_simd(const Kernel_params& k, float* x, int n)
+    {
+        const Kernel kernel = make_kernel<Kernel>(k);
+        for (int i = 0; i < n; i += V::lanes) {
+            kernel(V::load(x + i)).store(x + i);
+        }
+    }
+
+    template <typename V, typename Kernel>
+    void resample_cylindrical_simd(const Cylindrical_view& view)
+    {
+        const Plane_view& in = view.in;
+        const int n = view.n;
+        Kernel kernel[max_batch];
+        for (int b = 0; b < n; ++b) {
+            kernel[b] = make_kernel<Kernel>(view.k[b]);
+        }
+        const int bound = view.bound;
+        const int taps = 2 * bound;
+        const int row_taps = view.row_taps;
+        for (int oy = 0; oy < view.out[0].height; ++oy) {
+            const int base_y = view.base_y[oy];
+            const double fy = view.fy[oy];
+            for (int ox = 0; ox < view.out[0].width; ++ox) {
+                const int base_x = view.base_x[ox];
+                const double fx = view.fx[ox];
+                V csum[max_batch];
+                V wsum[max_batch];
+                for (int b = 0; b < n; ++b) {
+                    csum[b] = 0.0f;
+                    wsum[b] = 0.0f;
+                }
+
+                // Interior pixels read the taps straight from the source rows, only the borders clamp.
+                // The padding lanes have zero weight and stay inside of the row's pitch.
+                const int x0 = base_x + 1 - bound;
+                const bool interior = x0 >= 0 && x0 + taps <= in.width && x0 + row_taps <= in.pitch;
+                for (int y = 1 - bound; y <= bound; ++y) {
+                    const float* row = in.data + static_cast<size_t>(clamp_value(base_y + y, 0, in.height - 1)) * in.pitch;
+                    const float* color = view.colors;
+                    if (interior) {
+                        color = row + x0;
+                    }
+                    else {
+                        for (int x = 0; x < taps; ++x) {
+                            view.colors[x] = row[clamp_value(x0 + x, 0, in.width - 1)];
+                        }
+                    }
+                    const V dy = static_cast<float>(y - fy);
+                    for (int x = 0; x < row_taps; x += V::lanes) {
+                        const V dx = V::load(view.offsets + x) - static_cast<float>(fx);
+                        const V r = sqrt(fma(dx, dx, dy * dy)) * view.s;
+                        const V c = V::load(color + x);
+                        for (int b = 0; b < n; ++b) {
+                            const V weight = kernel[b](r);
+                            csum[b] = fma(c, weight, csum[b]);
+                            wsum[b] = wsum[b] + weight;
+                        }
+                    }
+                }
+
+                // Antiringing.
+                // The 2x2 taps nearest the sample give lo and hi.
+                float lo = 0.0f;
+                float hi = 0.0f;
+                if (view.ar > 0.0f) {
+                    const int x0 = clamp_value(base_x, 0, in.width - 1);
+                    const int x1 = clamp_value(base_x + 1, 0, in.width - 1);
+                    const float* row0 = in.data + static_cast<size_t>(clamp_value(base_y, 0, in.height - 1)) * in.pitch;
+                    const float* row1 = in.data + static_cast<size_t>(clamp_value(base_y + 1, 0, in.height - 1)) * in.pitch;
+                    lo = min_value(min_value(row0[x0], row0[x1]), min_value(row1[x0], row1[x1]));
+                    hi = max_value(max_value(row0[x0], row0[x1]), max_value(row1[x0], row1[x1]));
+                }
+
+                for (int b = 0; b < n; ++b) {
+
+                    // Normalize weighted color sum.
+                    float result = sum(csum[b]) / sum(wsum[b]);
+
+                    // Antiringing.
+                    if (view.ar > 0.0f) {
+                        result += (clamp_value(result, lo, hi) - result) * view.ar;
+                    }
+
+                    view.out[b].data[static_cast<size_t>(oy) * view.out[b].pitch + ox] = result;
+                }
+            }
+            if (view.srgb) {
+                for (int b = 0; b < n; ++b) {
+                    linear_to_srgb_row<V>(view.out[b], oy);
+                }
+            }
+        }
+    }
+
+    template <typename V>
+    void apply_stencil_table_simd(const Stencil_view& view)
+    {
+        const Plane_view& in = view.in;
+        const int n = view.n;
+        const int taps = view.taps;
+        const int bound = taps / 2;
+        const int* begin = view.begin;
+        const int* end = view.end;
+        for (int oy = 0; oy < view.out[0].height; ++oy) {
+            const int base_y = view.base_y[oy];
+            for (int ox = 0; ox < view.out[0].width; ++ox) {
+                const int base_x = view.base_x[ox];
+                const size_t stencil = static_cast<size_t>(oy % view.phases_y) * view.phases_x + ox % view.phases_x;
+                V csum[max_batch];
+                float tail[max_batch] = {};
+                for (int b = 0; b < n; ++b) {
+                    csum[b] = 0.0f;
+                }
+                for (int y = 0; y < taps; ++y) {
+                    const size_t r = stencil * taps + y;
+                    if (begin[r] >= end[r]) {
+                        continue;
+                    }
+                    const float* row = in.data + static_cast<size_t>(clamp_value(base_y + 1 - bound + y, 0, in.height - 1)) * in.pitch;
+                    const int x0 = base_x + 1 - bound;
+                    const float* color = view.colors;
+                    if (x0 + begin[r] >= 0 && x0 + end[r] <= in.width) {
+                        color = row + x0;
+                    }
+                    else {
+                        for (int x = begin[r]; x < end[r]; ++x) {
+                            view.colors[x] = row[clamp_value(x0 + x, 0, in.width - 1)];
+                        }
+                    }
+
+                    // V::lanes taps at a time, then the rest of the row.
+                    int x = begin[r];
+                    for (; x + V::lanes <= end[r]; x += V::lanes) {
+                        const V c = V::load(color + x);
+                        for (int b = 0; b < n; ++b) {
+                            csum[b] = fma(c, V::load(view.weights[b] + r * taps + x), csum[b]);
+                        }
+                    }
+                    for (; x < end[r]; ++x) {
+                        for (int b = 0; b < n; ++b) {
+                            tail[b] += color[x] * view.weights[b][r * taps + x];
+                        }
+                    }
+                }
+
+                // Antiringing.
+                // The 2x2 taps nearest the sample give lo and hi.
+                float lo = 0.0f;
+                float hi = 0.0f;
+                if (view.ar > 0.0f) {
+                    const int x0 = clamp_value(base_x, 0, in.width - 1);
+                    const int x1 = clamp_value(base_x + 1, 0, in.width - 1);
+                    const float* row0 = in.data + static_cast<size_t>(clamp_value(base_y, 0, in.height - 1)) * in.pitch;
+                    const float* row1 = in.data + static_cast<size_t>(clamp_value(base_y + 1, 0, in.height - 1)) * in.pitch;
+                    lo = min_value(min_value(row0[x0], row0[x1]), min_value(row1[x0], row1[x1]));
+                    hi = max_value(max_value(row0[x0], row0[x1]), max_value(row1[x0], row1[x1]));
+                }
+
+                for (int b = 0; b < n; ++b) {
+                    float result = sum(csum[b]) + tail[b];
+
+                    // Antiringing.
+                    if (view.ar > 0.0f) {
+                        result += (clamp_value(result, lo, hi) - result) * view.ar;
+                    }
+
+                    view.out[b].data[static_cast<size_t>(oy) * view.out[b].pitch + ox] = result;
+                }
+            }
+            if (view.srgb) {
+                for (int b = 0; b < n; ++b) {
+                    linear_to_srgb_row<V>(view.out[b], oy);
+                }
+            }
+        }
+    }
+
+    // Function pointer instances for select_kernel().
+    template <typename V>
+    struct Simd_instances
+    {
+        template <typename Kernel>
+        struct Evaluate_kernel_instance
+        {
+            static constexpr Evaluate_kernel function = evaluate_kernel_simd<V, Kernel>;
+        };
+
+        template <typename Kernel>
+        struct Resample_cylindrical_instance
+        {
+            static constexpr Resample_cylindrical_view function = resample_cylindrical_simd<V, Kernel>;
+        };
+    };
+
+    // Runs op over the first width samples of a block of registers, V::lanes at a time.
+    template <typename V, int op>
+    void expression_op_block(float* dst, const float* a, const float* b, int width)
+    {
+        for (int i = 0; i < width; i += V::lanes) {
+            expression_op<op>(V::load(a + i), V::load(b + i)).store(dst + i);
+        }
+    }
+
+    template <typename V>
+    struct Expression_op_blocks
+    {
+        void (*op[EXPRESSION_OP_COUNT])(float*, const float*, const float*, int);
+    };
+
+    template <typename V, size_t... ops>
+    constexpr Expression_op_blocks<V> expression_op_blocks(std::index_sequence<ops...>)
+    {
+        return { { expression_op_block<V, ops>... } };
+    }
+
+    template <typename V>
+    void evaluate_expression_simd(const Expression_view& expression, const float* x, float* out, int n, const Kernel_plugin_params& params)
+    {
+        static constexpr Expression_op_blocks<V> ops = expression_op_blocks<V>(std::make_index_sequence<EXPRESSION_OP_COUNT>());
+
+        // Parameters and constants are the same for every block.
+        // Resampling calls it with a vector of samples at a time too, then only that much of a block is used.
+        const int width = (min_value(n, expression_block) + V::lanes - 1) / V::lanes * V::lanes;
+        alignas(64) float registers[max_expression_registers][expression_block];
+        auto fill = [&](int r, int begin, float value) {
+            for (int j = begin; j < width; ++j) {
+                registers[r][j] = value;
+            }
+        };
+        fill(1, 0, params.radius);
+        fill(2, 0, params.blur);
+        fill(3, 0, params.p1);
+        fill(4, 0, params.p2);
+        for (int i = 0; i < expression.constant_count; ++i) {
+            fill(expression_inputs + i, 0, expression.constants[i]);
+        }
+
+        for (int i = 0; i < n; i += expression_block) {
+            const int count = min_value(expression_block, n - i);
+            for (int j = 0; j < count; ++j) {
+                registers[0][j] = x[i + j];
+            }
+            fill(0, count, 0.0f);
+            for (int j = 0; j < expression.instruction_count; ++j) {
+                const Expression_instruction& instruction = expression.code[j];
+                ops.op[instruction.op](registers[instruction.dst], registers[instruction.a], registers[instruction.b], width);
+            }
+
+            // Zero at and past the radius, the result register is free again.
+            float* result = registers[expression.result];
+            for (int j = 0; j < width; j += V::lanes) {
+                select(V::load(registers[0] + j) < params.radius, V::load(result + j), V(0.0f)).store(result + j);
+            }
+            for (int j = 0; j < count; ++j) {
+                out[i + j] = result[j];
+            }
+        }
+    }
+
+    // Every function of simd_math.h over n elements.
+    template <typename V>
+    void evaluate_math_simd(int function, const float* x, const float* y, float* out, int n)
+    {
+        for (int i = 0; i < n; i += V::lanes) {
+            const V a = V::load(x + i);
+            V r;
+            switch (function) {
+                case MATH_FUNCTION_SIN:
+                    r = simd_math::sin(a);
+                    break;
+                case MATH_FUNCTION_COS:
+                    r = simd_math::cos(a);
+                    break;
+                case MATH_FUNCTION_EXP:
+                    r = simd_math::exp(a);
+                    break;
+                case MATH_FUNCTION_LOG:
+                    r = simd_math::log(a);
+                    break;
+                case MATH_FUNCTION_POW:
+                    r = simd_math::pow(a, V::load(y + i));
+                    break;
+                case MATH_FUNCTION_COSH:
+                    r = simd_math::cosh(a);
+                    break;
+                case MATH_FUNCTION_BESSEL_I0:
+                    r = kernel_functions::bessel_I0(a);
+                    break;
+                case MATH_FUNCTION_BESSEL_J1:
+                    r = kernel_functions::bessel_J1(a);
+                    break;
+            }
+            r.store(out + i);
+        }
+    }
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "common.h"
+
+#include <immintrin.h>
+
+// Thin wrappers over SIMD registers, so the kernel functors and simd_math.h are written once for every width.
+// A type is only used in the translation unit compiled for its ISA, see resample_avx2.cpp and resample_avx512.cpp.
+// Scalar code uses double and select() below.
+// Operators are friends, so scalars in expressions are broadcast.
+// precise_math picks the accuracy of simd_math.h.
+
+inline double select(bool mask, double a, double b)
+{
+    return mask ? a : b;
+}
+
+#ifdef __AVX2__
+struct Mask_avx2
+{
+    __m256 m;
+    friend Mask_avx2 operator&(Mask_avx2 a, Mask_avx2 b) { return { _mm256_and_ps(a.m, b.m) }; }
+    friend Mask_avx2 operator|(Mask_avx2 a, Mask_avx2 b) { return { _mm256_or_ps(a.m, b.m) }; }
+    friend Mask_avx2 operator!(Mask_avx2 a) { return { _mm256_xor_ps(a.m, _mm256_castsi256_ps(_mm256_set1_epi32(-1))) }; }
+};
+
+template <bool precise_math>
+struct Vec_avx2
+{
+    static constexpr int lanes = 8;
+    static constexpr bool precise = precise_math;
+    using Mask = Mask_avx2;
+    Vec_avx2() = default;
+    Vec_avx2(__m256 v) : v(v) {}
+    Vec_avx2(float f) : v(_mm256_set1_ps(f)) {}
+    Vec_avx2(double d) : v(_mm256_set1_ps(static_cast<float>(d))) {}
+    static Vec_avx2 load(const float* p) { return _mm256_loadu_ps(p); }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+    friend Vec_avx2 operator+(Vec_avx2 a, Vec_avx2 b) { return _mm256_add_ps(a.v, b.v); }
+    friend Vec_avx2 operator-(Vec_avx2 a, Vec_avx2 b) { return _mm256_sub_ps(a.v, b.v); }
+    friend Vec_avx2 operator*(Vec_avx2 a, Vec_avx2 b) { return _mm256_mul_ps(a.v, b.v); }
+    friend Vec_avx2 operator/(Vec_avx2 a, Vec_avx2 b) { return _mm256_div_ps(a.v, b.v); }
+    friend Vec_avx2 operator-(Vec_avx2 a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+    friend Mask operator<(Vec_avx2 a, Vec_avx2 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+    friend Mask operator<=(Vec_avx2 a, Vec_avx2 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+    friend Mask operator>(Vec_avx2 a, Vec_avx2 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+    friend Mask operator>=(Vec_avx2 a, Vec_avx2 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+    friend Mask operator==(Vec_avx2 a, Vec_avx2 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ) }; }
+    friend Mask operator!=(Vec_avx2 a, Vec_avx2 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_NEQ_UQ) }; }
+    friend Vec_avx2 select(Mask mask, Vec_avx2 a, Vec_avx2 b) { return _mm256_blendv_ps(b.v, a.v, mask.m); }
+    friend Vec_avx2 fma(Vec_avx2 a, Vec_avx2 b, Vec_avx2 c) { return _mm256_fmadd_ps(a.v, b.v, c.v); }
+    friend Vec_avx2 min(Vec_avx2 a, Vec_avx2 b) { return _mm256_min_ps(a.v, b.v); }
+    friend Vec_avx2 max(Vec_avx2 a, Vec_avx2 b) { return _mm256_max_ps(a.v, b.v); }
+    friend Vec_avx2 abs(Vec_avx2 a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+    friend Vec_avx2 sqrt(Vec_avx2 a) { return _mm256_sqrt_ps(a.v); }
+    friend Vec_avx2 floor(Vec_avx2 a) { return _mm256_floor_ps(a.v); }
+    friend Vec_avx2 round(Vec_avx2 a) { return _mm256_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+    // Horizontal sum.
+    friend float sum(Vec_avx2 a)
+    {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehdup_ps(s)));
+    }
+
+    // 2^n for integral n in [-126, 127].
+    friend Vec_avx2 pow2i(Vec_avx2 n)
+    {
+        return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n.v), _mm256_set1_epi32(127)), 23));
+    }
+
+    // Splits normal positive x into m * 2^e, m in [1, 2).
+    friend Vec_avx2 split_exponent(Vec_avx2 x, Vec_avx2& e)
+    {
+        const __m256i bits = _mm256_castps_si256(x.v);
+        e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+        return _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000)));
+    }
+
+    __m256 v;
+};
+#endif
+
+#ifdef __AVX512F__
+struct Mask_avx512
+{
+    __mmask16 m;
+    friend Mask_avx512 operator&(Mask_avx512 a, Mask_avx512 b) { return { static_cast<__mmask16>(a.m & b.m) }; }
+    friend Mask_avx512 operator|(Mask_avx512 a, Mask_avx512 b) { return { static_cast<__mmask16>(a.m | b.m) }; }
+    friend Mask_avx512 operator!(Mask_avx512 a) { return { static_cast<__mmask16>(~a.m) }; }
+};
+
+template <bool precise_math>
+struct Vec_avx512
+{
+    static constexpr int lanes = 16;
+    static constexpr bool precise = precise_math;
+    using Mask = Mask_avx512;
+    Vec_avx512() = default;
+    Vec_avx512(__m512 v) : v(v) {}
+    Vec_avx512(float f) : v(_mm512_set1_ps(f)) {}
+    Vec_avx512(double d) : v(_mm512_set1_ps(static_cast<float>(d))) {}
+    static Vec_avx512 load(const float* p) { return _mm512_loadu_ps(p); }
+    void store(float* p) const { _mm512_storeu_ps(p, v); }
+    friend Vec_avx512 operator+(Vec_avx512 a, Vec_avx512 b) { return _mm512_add_ps(a.v, b.v); }
+    friend Vec_avx512 operator-(Vec_avx512 a, Vec_avx512 b) { return _mm512_sub_ps(a.v, b.v); }
+    friend Vec_avx512 operator*(Vec_avx512 a, Vec_avx512 b) { return _mm512_mul_ps(a.v, b.v); }
+    friend Vec_avx512 operator/(Vec_avx512 a, Vec_avx512 b) { return _mm512_div_ps(a.v, b.v); }
+    friend Vec_avx512 operator-(Vec_avx512 a) { return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a.v), _mm512_set1_epi32(0x80000000))); }
+    friend Mask operator<(Vec_avx512 a, Vec_avx512 b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; }
+    friend Mask operator<=(Vec_avx512 a, Vec_avx512 b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ) }; }
+    friend Mask operator>(Vec_avx512 a, Vec_avx512 b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ) }; }
+    friend Mask operator>=(Vec_avx512 a, Vec_avx512 b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ) }; }
+    friend Mask operator==(Vec_avx512 a, Vec_avx512 b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_EQ_OQ) }; }
+    friend Mask operator!=(Vec_avx512 a, Vec_avx512 b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_NEQ_UQ) }; }
+    friend Vec_avx512 select(Mask mask, Vec_avx512 a, Vec_avx512 b) { return _mm512_mask_blend_ps(mask.m, b.v, a.v); }
+    friend Vec_avx512 fma(Vec_avx512 a, Vec_avx512 b, Vec_avx512 c) { return _mm512_fmadd_ps(a.v, b.v, c.v); }
+    friend Vec_avx512 min(Vec_avx512 a, Vec_avx512 b) { return _mm512_min_ps(a.v, b.v); }
+    friend Vec_avx512 max(Vec_avx512 a, Vec_avx512 b) { return _mm512_max_ps(a.v, b.v); }
+    friend Vec_avx512 abs(Vec_avx512 a) { return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a.v), _mm512_set1_epi32(0x7fffffff))); }
+    friend Vec_avx512 sqrt(Vec_avx512 a) { return _mm512_sqrt_ps(a.v); }
+    friend Vec_avx512 floor(Vec_avx512 a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+    friend Vec_avx512 round(Vec_avx512 a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+    // Horizontal sum.
+    friend float sum(Vec_avx512 a) { return _mm512_reduce_add_ps(a.v); }
+
+    // 2^n for integral n in [-126, 127].
+    friend Vec_avx512 pow2i(Vec_avx512 n)
+    {
+        return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n.v), _mm512_set1_epi32(127)), 23));
+    }
+
+    // Splits normal positive x into m * 2^e, m in [1, 2).
+    friend Vec_avx512 split_exponent(Vec_avx512 x, Vec_avx512& e)
+    {
+        const __m512i bits = _mm512_castps_si512(x.v);
+        e = _mm512_cvtepi32_ps(_mm512_sub_epi32(_mm512_srli_epi32(bits, 23), _mm512_set1_epi32(127)));
+        return _mm512_castsi512_ps(_mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi32(0x007fffff)), _mm512_set1_epi32(0x3f800000)));
+    }
+
+    __m512 v;
+};
+#endif
@@ -0,0 +1,97 @@
+#include "simd_math.h"
+#include "kernel_functions.h"
+#include "cpu_features.h"
+
+// Distance from the reference in units of the last place of a float of the given magnitude.
+static double ulp_error(float value, double reference, double magnitude)
+{
+    const float m = static_cast<float>(magnitude);
+    const double ulp = std::nextafter(m, std::numeric_limits<float>::infinity()) - m;
+    return std::abs(value - reference) / ulp;
+}
+
+bool check_math()
+{
+    Evaluate_math evaluate_math;
+    const Isa isa = detect_isa();
+    switch (isa) {
+        case ISA_AVX512:
+            evaluate_math = evaluate_math_avx512;
+            break;
+        case ISA_AVX2:
+            evaluate_math = evaluate_math_avx2;
+            break;
+        default:
+            return false;
+    }
+
+    // Name, reference and the argument range of each function, wider than what the kernels use.
+    // Errors are relative to max(abs(reference), floor).
+    // The bounds of both tiers in ulp are the accuracy the --fast-math help and README.md state, with some margin.
+    struct Test
+    {
+        const char* name;
+        double (*reference)(double x, double y);
+        double lo;
+        double hi;
+        bool logarithmic;
+        double floor;
+        double precise_ulp;
+        double fast_ulp;
+    };
+    const Test tests[MATH_FUNCTION_COUNT] = {
+        { "sin", [](double x, double) { return std::sin(x); }, -100.0, 100.0, false, 0.0, 2.5, 6.5 },
+        { "cos", [](double x, double) { return std::cos(x); }, -100.0, 100.0, false, 0.0, 2.5, 6.5 },
+        { "exp", [](double x, double) { return std::exp(x); }, -87.0, 88.0, false, 0.0, 2.5, 2.5 },
+        { "log", [](double x, double) { return std::log(x); }, 1e-30, 1e30, true, 0.0, 2.5, 2.5 },
+        { "pow", [](double x, double y) { return std::pow(x, y); }, 1e-4, 4.0, true, 0.0, 2.5, 6.5 },
+        { "cosh", [](double x, double) { return std::cosh(x); }, -80.0, 80.0, false, 0.0, 2.5, 2.5 },
+
+        // Against the approximation in kernel_functions.hlsli evaluated in double.
+        // J1 is computed from a float argument like in the shader, next to its zeros that error is measured against its amplitude.
+        { "bessel_I0", [](double x, double) { return kernel_functions::bessel_I0(x); }, 0.0, 80.0, false, 0.0, 20.0, 20.0 },
+        { "bessel_J1", [](double x, double) { return kernel_functions::bessel_J1(x); }, 0.0, 100.0, false, 0.1, 20.0, 20.0 },
+    };
+
+    constexpr int n = 1 << 20;
+    std::vector<float> x(n);
+    std::vector<float> y(n);
+    std::vector<float> out(n);
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    std::cout << "SIMD math accuracy (" << isa_name(isa) << ", " << n << " random arguments per function):\n";
+    std::cout << "function    precise: max ulp   max rel.     fast: max ulp   max rel.\n";
+    bool ok = true;
+    for (int f = 0; f < MATH_FUNCTION_COUNT; ++f) {
+        const Test& test = tests[f];
+        for (int i = 0; i < n; ++i) {
+            const double t = uniform(rng);
+            x[i] = static_cast<float>(test.logarithmic ? test.lo * std::pow(test.hi / test.lo, t) : test.lo + (test.hi - test.lo) * t);
+            y[i] = static_cast<float>(uniform(rng) * 16.0 - 8.0);
+        }
+        std::cout << std::left << std::setw(12) << test.name << std::right;
+        for (bool precise : { true, false }) {
+            evaluate_math(f, precise, x.data(), y.data(), out.data(), n);
+            double max_ulp = 0.0;
+            double max_rel = 0.0;
+            for (int i = 0; i < n; ++i) {
+                const double reference = test.reference(x[i], y[i]);
+
+                // Results float can't hold are out of scope.
+                if (!std::isfinite(reference) || std::abs(reference) > std::numeric_limits<float>::max() || std::abs(reference) < std::numeric_limits<float>::min()) {
+                    continue;
+                }
+                const double magnitude = std::max(std::abs(reference), test.floor);
+                max_ulp = std::max(max_ulp, ulp_error(out[i], reference, magnitude));
+                max_rel = std::max(max_rel, std::abs(out[i] - reference) / magnitude);
+            }
+            std::cout << std::setw(22) << std::setprecision(2) << std::fixed << max_ulp << std::setw(11) << std::scientific << max_rel;
+            ok = ok && max_ulp <= (precise ? test.precise_ulp : test.fast_ulp);
+        }
+        std::cout << "\n";
+    }
+    std::cout << std::defaultfloat;
+    std::cout << (ok ? "All within" : "Some above") << " their bounds.\n";
+    return ok;
+}
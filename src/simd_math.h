@@ -0,0 +1,289 @@
+#pragma once
+
+#include "common.h"
+#include "simd.h"
+
+// Transcendental functions for the kernel functors, written once for double and every vector type of simd.h.
+// Double forwards to the C++ library, so the scalar path stays the reference.
+// Vector types use Cephes style polynomial approximations in float, with two accuracy tiers picked by V::precise:
+// precise is within ~1 ulp of float (2 at most) and handles zero, infinity and denormal arguments like libm,
+// fast sin() and pow() are within ~6 ulp (4.5e-7 relative) for kernel arguments.
+// See check_math() for the measured errors.
+namespace simd_math
+{
+    // Constants for the vector branches, so the ISA translation units don't instantiate numeric_limits functions.
+    inline constexpr float infinity = std::numeric_limits<float>::infinity();
+    inline constexpr float quiet_nan = std::numeric_limits<float>::quiet_NaN();
+
+    template <typename T>
+    inline constexpr bool is_scalar = std::is_same_v<T, double>;
+
+    template <typename T>
+    inline T abs(T x)
+    {
+        if constexpr (is_scalar<T>) {
+            return std::abs(x);
+        }
+        else {
+            return abs(x);
+        }
+    }
+
+    template <typename T>
+    inline T sqrt(T x)
+    {
+        if constexpr (is_scalar<T>) {
+            return std::sqrt(x);
+        }
+        else {
+            return sqrt(x);
+        }
+    }
+
+    // Returns x - q * pi / 2 for the nearest integral q.
+    // Fast drops the last term of the Cody-Waite reduction, good for abs(x) < 1e3.
+    template <typename V>
+    inline V reduce_pi_2(V x, V& q)
+    {
+        q = round(x * 0.636619772367581343076);
+        V r = fma(q, -1.57079637050628662109375, x);
+        r = fma(q, 4.37113900018624283e-8, r);
+        if constexpr (V::precise) {
+            r = fma(q, 1.7151245100059376e-15, r);
+        }
+        return r;
+    }
+
+    // sin(x) for q even and cos(x) for q odd, on [-pi/4, pi/4].
+    template <typename V>
+    inline V sin_cos_kernel(V r, V q)
+    {
+        const V z = r * r;
+        const V s = fma(r * z, fma(z, fma(z, -1.9515295891e-4, 8.3321608736e-3), -1.6666654611e-1), r);
+        const V c = fma(z * z, fma(z, fma(z, 2.443315711809948e-5, -1.388731625493765e-3), 4.166664568298827e-2), fma(z, -0.5, 1.0));
+        const V v = select(q - 2.0 * floor(q * 0.5) == 1.0, c, s);
+
+        // Quadrants 2 and 3 are negated.
+        return select(q - 4.0 * floor(q * 0.25) >= 2.0, -v, v);
+    }
+
+    template <typename T>
+    inline T sin(T x)
+    {
+        if constexpr (is_scalar<T>) {
+            return std::sin(x);
+        }
+        else {
+            T q;
+            const T r = reduce_pi_2(x, q);
+            return sin_cos_kernel(r, q);
+        }
+    }
+
+    template <typename T>
+    inline T cos(T x)
+    {
+        if constexpr (is_scalar<T>) {
+            return std::cos(x);
+        }
+        else {
+            T q;
+            const T r = reduce_pi_2(x, q);
+            return sin_cos_kernel(r, q + 1.0);
+        }
+    }
+
+    // cos(x + shift) for small shift, x is reduced before the shift is added so large x keeps its precision.
+    template <typename T>
+    inline T cos(T x, std::type_identity_t<T> shift)
+    {
+        if constexpr (is_scalar<T>) {
+            return std::cos(x + shift);
+        }
+        else {
+            T q;
+            T q_shift;
+            const T r = reduce_pi_2(reduce_pi_2(x, q) + shift, q_shift);
+            return sin_cos_kernel(r, q + q_shift + 1.0);
+        }
+    }
+
+    template <typename T>
+    inline T exp(T x)
+    {
+        if constexpr (is_scalar<T>) {
+            return std::exp(x);
+        }
+        else {
+
+            // Fast saturates instead of returning 0 or inf.
+            if constexpr (!T::precise) {
+                x = min(max(x, -87.3), 88.3);
+            }
+
+            // exp(x) = 2^n * exp(r), abs(r) <= ln(2) / 2.
+            const T n = round(x * 1.44269504088896341);
+            T r = fma(n, -0.693359375, x);
+            r = fma(n, 2.12194440e-4, r);
+            const T p = fma(fma(fma(fma(fma(r, 1.9875691500e-4, 1.3981999507e-3), r, 8.3334519073e-3), r, 4.1665795894e-2), r, 1.6666665459e-1), r, 5.0000001201e-1);
+            const T y = fma(p, r * r, r + 1.0);
+            if constexpr (T::precise) {
+
+                // Scale in two steps, so 2^n can't overflow and denormal results are kept.
+                const T clamped = min(max(n, -150.0), 128.0);
+                const T n1 = floor(clamped * 0.5);
+                const T result = y * pow2i(n1) * pow2i(clamped - n1);
+                return select(x > 88.72283935546875, infinity, select(x < -103.972084045410, 0.0, select(x != x, x, result)));
+            }
+            else {
+                return y * pow2i(n);
+            }
+        }
+    }
+
+    // log(x) = e * ln(2) + f + tail, returns f and tail separately so pow() can keep the rounding error of the sum.
+    template <typename V>
+    inline V log_parts(V x, V& e, V& tail)
+    {
+        V m;
+        if constexpr (V::precise) {
+
+            // Normalize denormals.
+            const auto small = x < 1.17549435e-38;
+            m = split_exponent(select(small, x * 8388608.0, x), e);
+            e = select(small, e - 23.0, e);
+        }
+        else {
+            m = split_exponent(x, e);
+        }
+
+        // Keep m in [sqrt(0.5), sqrt(2)).
+        const auto big = m > 1.41421356237309504880;
+        m = select(big, m * 0.5, m);
+        e = select(big, e + 1.0, e);
+
+        const V f = m - 1.0;
+        const V z = f * f;
+        V p = fma(f, 7.0376836292e-2, -1.1514610310e-1);
+        p = fma(p, f, 1.1676998740e-1);
+        p = fma(p, f, -1.2420140846e-1);
+        p = fma(p, f, 1.4249322787e-1);
+        p = fma(p, f, -1.6668057665e-1);
+        p = fma(p, f, 2.0000714765e-1);
+        p = fma(p, f, -2.4999993993e-1);
+        p = fma(p, f, 3.3333331174e-1);
+        tail = fma(f * z, p, fma(e, -2.12194440e-4, -0.5 * z));
+        return f;
+    }
+
+    template <typename T>
+    inline T log(T x)
+    {
+        if constexpr (is_scalar<T>) {
+            return std::log(x);
+        }
+        else {
+            T e;
+            T tail;
+            const T f = log_parts(x, e, tail);
+            const T result = fma(e, 0.693359375, f + tail);
+            if constexpr (T::precise) {
+                const T inf = infinity;
+                return select(x == 0.0, -inf, select(x < 0.0, quiet_nan, select(x == inf, inf, select(x != x, x, result))));
+            }
+            else {
+                return result;
+            }
+        }
+    }
+
+    // Same special cases as std::pow() for finite arguments, negative x needs integral y.
+    template <typename T>
+    inline T pow(T x, std::type_identity_t<T> y)
+    {
+        if constexpr (is_scalar<T>) {
+            return std::pow(x, y);
+        }
+        else {
+            const T ax = abs(x);
+            T e;
+            T tail;
+            const T f = log_parts(ax, e, tail);
+
+            // log(ax) as hi + lo, then y * log(ax) as hi + lo, exp(hi + lo) = exp(hi) * (1 + lo).
+            // Rounding log(ax) to a float would be off by abs(y * log(ax)) ulp, so the fast tier keeps its lo as well,
+            // it only rounds f + tail, which is within 0.5 in magnitude.
+            const T a = e * 0.693359375;
+            T hi;
+            T lo;
+            if constexpr (T::precise) {
+                const T s = a + f;
+                const T bb = s - a;
+                const T s_lo = (a - (s - bb)) + (f - bb) + tail;
+                hi = s + s_lo;
+                lo = s_lo - (hi - s);
+            }
+            else {
+
+                // a is 0 or larger than f + tail in magnitude, so this sum is exact.
+                const T b = f + tail;
+                hi = a + b;
+                lo = (a - hi) + b;
+            }
+            const T p_hi = y * hi;
+            const T p_lo = fma(y, hi, -p_hi) + y * lo;
+            const T r = exp(p_hi);
+            T result = select(abs(r) == infinity, r, fma(r, p_lo, r));
+
+            // x = 0.
+            const T inf = infinity;
+            result = select(ax == 0.0, select(y > 0.0, 0.0, inf), result);
+
+            // Negative x, odd y flips the sign, fractional y is NaN.
+            const T half = y * 0.5;
+            const T odd = select(floor(half) != half, -result, result);
+            result = select(x < 0.0, select(floor(y) == y, odd, quiet_nan), result);
+
+            // pow(x, 0) = pow(1, y) = 1.
+            return select((y == 0.0) | (x == 1.0), 1.0, result);
+        }
+    }
+
+    template <typename T>
+    inline T cosh(T x)
+    {
+        if constexpr (is_scalar<T>) {
+            return std::cosh(x);
+        }
+        else {
+            const T t = exp(abs(x));
+            return 0.5 * (t + 1.0 / t);
+        }
+    }
+}
+
+// Batch evaluation, used to check the approximations.
+
+// enum MATH_FUNCTION_
+enum Math_function
+{
+    MATH_FUNCTION_SIN,
+    MATH_FUNCTION_COS,
+    MATH_FUNCTION_EXP,
+    MATH_FUNCTION_LOG,
+    MATH_FUNCTION_POW,
+    MATH_FUNCTION_COSH,
+    MATH_FUNCTION_BESSEL_I0,
+    MATH_FUNCTION_BESSEL_J1,
+    MATH_FUNCTION_COUNT
+};
+
+// out[i] = function(x[i]) or function(x[i], y[i]), n has to be a multiple of 16.
+using Evaluate_math = void (*)(int function, bool precise, const float* x, const float* y, float* out, int n);
+
+void evaluate_math_avx2(int function, bool precise, const float* x, const float* y, float* out, int n);
+void evaluate_math_avx512(int function, bool precise, const float* x, const float* y, float* out, int n);
+
+// Prints the max ulp and relative errors of both tiers against the double reference.
+// Returns false if the CPU has no vector path or an error is above the bound of its function and tier.
+bool check_math();
@@ -0,0 +1,284 @@
+#include "ssim.h"
+
+// Same as ImageMetrics::Reflect().
+static int reflect(int val, int max)
+{
+    if (val < 0) {
+        val = -val - 1;
+    }
+    if (val >= max) {
+        val = 2 * max - val - 1;
+    }
+    return val;
+}
+
+std::array<double, ssim_window> gaussian_window()
+{
+    std::array<double, ssim_window> window;
+    double sum = 0.0;
+    for (int i = 0; i < ssim_window; ++i) {
+        const double d = i - ssim_window / 2;
+        window[i] = std::exp(-(d * d) / (2.0 * 1.5 * 1.5));
+        sum += window[i];
+    }
+    for (auto& w : window) {
+        w /= sum;
+    }
+    return window;
+}
+
+// Range of ImageMetrics::SubSample()'s box around a sample, [lo, hi], an even box is shifted right.
+static void box_range(int factor, int& lo, int& hi)
+{
+    lo = -factor / 2;
+    hi = factor / 2;
+    if (factor % 2 == 0) {
+        ++lo;
+    }
+}
+
+void Ssim_subsampler::init(int width, int height, int factor, int first)
+{
+    this->factor = factor;
+    full_width = width;
+    full_height = height;
+    this->width = width / factor;
+    this->height = height / factor;
+    y = first;
+    box_range(factor, lo, hi);
+    sums.assign(factor, std::vector<double>(this->width));
+}
+
+template <typename T>
+bool Ssim_subsampler::add_row(const T* row, double scale, std::vector<double>& out)
+{
+    out.resize(width);
+    if (factor == 1) {
+        for (int x = 0; x < width; ++x) {
+            out[x] = row[x] * scale;
+        }
+        ++y;
+        return true;
+    }
+
+    // Horizontal box sums, only the first box reflects.
+    std::vector<double>& sum = sums[y % factor];
+    for (int x = 0; x < width; ++x) {
+        double s = 0.0;
+        for (int i = lo; i <= hi; ++i) {
+            s += row[reflect(x * factor + i, full_width)];
+        }
+        sum[x] = s;
+    }
+
+    // Subsampled row j is complete with full resolution row j * factor + hi.
+    // Its box is the last factor rows, the first one reflects to rows among them too, the last one never reaches the edge.
+    const bool complete = y >= hi && (y - hi) % factor == 0 && (y - hi) / factor < height;
+    if (complete) {
+        const int j = (y - hi) / factor;
+        const double norm = scale / (factor * factor);
+        std::fill(out.begin(), out.end(), 0.0);
+        for (int i = lo; i <= hi; ++i) {
+            const std::vector<double>& s = sums[reflect(j * factor + i, full_height) % factor];
+            for (int x = 0; x < width; ++x) {
+                out[x] += s[x];
+            }
+        }
+        for (int x = 0; x < width; ++x) {
+            out[x] *= norm;
+        }
+    }
+    ++y;
+    return complete;
+}
+
+// Ssim_gradient subsamples its float images too.
+template bool Ssim_subsampler::add_row(const float* row, double scale, std::vector<double>& out);
+
+template <int channels>
+void Ssim_gaussian<channels>::init(int width)
+{
+    this->width = width;
+    y = 0;
+    for (auto& row : rows) {
+        for (auto& channel : row) {
+            channel.resize(width - ssim_window + 1);
+        }
+    }
+}
+
+template <int channels>
+bool Ssim_gaussian<channels>::add_row(const std::array<const double*, channels>& row, std::array<std::vector<double>, channels>& out)
+{
+    static const std::array<double, ssim_window> window = gaussian_window();
+    const int out_width = width - ssim_window + 1;
+
+    // Horizontal.
+    auto& filtered = rows[y % ssim_window];
+    for (int c = 0; c < channels; ++c) {
+        for (int x = 0; x < out_width; ++x) {
+            double sum = 0.0;
+            for (int i = 0; i < ssim_window; ++i) {
+                sum += row[c][x + i] * window[i];
+            }
+            filtered[c][x] = sum;
+        }
+    }
+    ++y;
+    if (y < ssim_window) {
+        return false;
+    }
+
+    // Vertical, over the last ssim_window rows.
+    for (int c = 0; c < channels; ++c) {
+        out[c].assign(out_width, 0.0);
+        for (int i = 0; i < ssim_window; ++i) {
+            const std::vector<double>& r = rows[(y - ssim_window + i) % ssim_window][c];
+            for (int x = 0; x < out_width; ++x) {
+                out[c][x] += r[x] * window[i];
+            }
+        }
+    }
+    return true;
+}
+
+// Same as ImageMetrics::ComputeSSIM().
+static int subsampling_factor(int width, int height)
+{
+    return static_cast<int>(std::max(1.0, std::round(std::min(width, height) / 256.0)));
+}
+
+void create_ssim_reference(Ssim_reference& reference, const uint8_t* data, int width, int height)
+{
+    reference.width = width;
+    reference.height = height;
+    reference.factor = subsampling_factor(width, height);
+    Ssim_subsampler subsampler;
+    subsampler.init(width, height, reference.factor);
+    reference.sub_width = subsampler.width;
+    reference.sub_height = subsampler.height;
+    reference.image.clear();
+    reference.mu.clear();
+    reference.sigma_sq.clear();
+    Ssim_gaussian<2> gaussian;
+    gaussian.init(subsampler.width);
+    std::vector<double> row;
+    std::vector<double> squares(subsampler.width);
+    std::array<std::vector<double>, 2> filtered;
+    for (int y = 0; y < height; ++y) {
+        if (!subsampler.add_row(data + static_cast<size_t>(y) * width, 1.0 / 255.0, row)) {
+            continue;
+        }
+        reference.image.insert(reference.image.end(), row.begin(), row.end());
+        for (int x = 0; x < subsampler.width; ++x) {
+            squares[x] = row[x] * row[x];
+        }
+        if (gaussian.add_row({ row.data(), squares.data() }, filtered)) {
+            for (size_t x = 0; x < filtered[0].size(); ++x) {
+                reference.mu.push_back(filtered[0][x]);
+                reference.sigma_sq.push_back(filtered[1][x] - filtered[0][x] * filtered[0][x]);
+            }
+        }
+    }
+}
+
+void Streaming_ssim::begin(const Ssim_reference& reference)
+{
+    begin(reference, 0, reference.sub_height - ssim_window + 1);
+}
+
+void Streaming_ssim::begin(const Ssim_reference& reference, int map_begin, int map_end)
+{
+    this->reference = &reference;
+    sub_row = map_begin;
+    this->map_begin = map_begin;
+    this->map_end = map_end;
+    map_row = map_begin;
+    sum = 0.0;
+    subsampler.init(reference.width, reference.height, reference.factor, first_row(false));
+    gaussian.init(reference.sub_width);
+    for (auto& product : products) {
+        product.resize(reference.sub_width);
+    }
+}
+
+// Map row j needs subsampled rows [j, j + ssim_window), subsampled row j the box of full resolution rows around j * factor.
+int Streaming_ssim::first_row(bool subsampled) const
+{
+    if (subsampled) {
+        return map_begin;
+    }
+    int lo;
+    int hi;
+    box_range(reference->factor, lo, hi);
+    return std::max(map_begin * reference->factor + lo, 0);
+}
+
+int Streaming_ssim::end_row(bool subsampled) const
+{
+    if (subsampled) {
+        return map_end + ssim_window - 1;
+    }
+    int lo;
+    int hi;
+    box_range(reference->factor, lo, hi);
+    return (map_end + ssim_window - 2) * reference->factor + hi + 1;
+}
+
+void Streaming_ssim::merge(const Streaming_ssim& tile)
+{
+    sum += tile.sum;
+}
+
+void Streaming_ssim::add_row(const float* row)
+{
+    if (subsampler.add_row(row, 1.0, image)) {
+        add_image_row();
+    }
+}
+
+void Streaming_ssim::add_subsampled_row(const float* row)
+{
+    image.assign(row, row + reference->sub_width);
+    add_image_row();
+}
+
+// Scores the subsampled row in image.
+void Streaming_ssim::add_image_row()
+{
+    const int width = reference->sub_width;
+    const double* reference_row = reference->image.data() + static_cast<size_t>(sub_row) * width;
+    ++sub_row;
+    for (int x = 0; x < width; ++x) {
+        products[0][x] = image[x];
+        products[1][x] = image[x] * image[x];
+        products[2][x] = image[x] * reference_row[x];
+    }
+    if (!gaussian.add_row({ products[0].data(), products[1].data(), products[2].data() }, filtered) || map_row >= map_end) {
+        return;
+    }
+
+    // Constants from the paper, L = 1.
+    constexpr double c1 = 0.01 * 0.01;
+    constexpr double c2 = 0.03 * 0.03;
+
+    const int map_width = width - ssim_window + 1;
+    const double* mu2 = reference->mu.data() + static_cast<size_t>(map_row) * map_width;
+    const double* sigma2_sq = reference->sigma_sq.data() + static_cast<size_t>(map_row) * map_width;
+    for (int x = 0; x < map_width; ++x) {
+        const double mu1 = filtered[0][x];
+        const double mu1_mu2 = mu1 * mu2[x];
+        const double mu1_sq = mu1 * mu1;
+        const double sigma1_sq = filtered[1][x] - mu1_sq;
+        const double sigma12 = filtered[2][x] - mu1_mu2;
+        sum += (2 * mu1_mu2 + c1) * (2 * sigma12 + c2) / ((mu1_sq + mu2[x] * mu2[x] + c1) * (sigma1_sq + sigma2_sq[x] + c2));
+    }
+    ++map_row;
+}
+
+double Streaming_ssim::result() const
+{
+    const int map_width = reference->sub_width - ssim_window + 1;
+    const int map_height = reference->sub_height - ssim_window + 1;
+    return sum / (static_cast<double>(map_width) * map_height);
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "common.h"
+
+// SSIM of ImageMetrics.h computed from rows fed in order, so neither image has to be held in full.
+// Same automatic box subsampling (with its Reflect() edge rule), 11x11 Gaussian window of sigma 1.5 and constants,
+// the window is applied separably, so results differ only by double rounding.
+// Subsampled images have to be at least 11x11, like in ImageMetrics.h.
+
+// Size of the Gaussian window.
+inline constexpr int ssim_window = 11;
+
+// Normalized 1D Gaussian, the outer product of it with itself is ImageMetrics::Gaussian(11, 1.5).
+std::array<double, ssim_window> gaussian_window();
+
+// Box subsampling of ImageMetrics::SubSample() over rows fed in order.
+class Ssim_subsampler
+{
+public:
+    // Rows are fed from first, the start of a box or 0.
+    void init(int width, int height, int factor, int first = 0);
+
+    // Returns true if the row completed the next subsampled row, which is then in out, scaled by scale.
+    template <typename T>
+    bool add_row(const T* row, double scale, std::vector<double>& out);
+
+    // Subsampled size.
+    int width;
+    int height;
+private:
+    int factor;
+    int full_width;
+    int full_height;
+
+    // Range of the box around a sample, [lo, hi].
+    int lo;
+    int hi;
+
+    // Next full resolution row.
+    int y;
+
+    // Horizontal box sums of the last factor rows.
+    std::vector<std::vector<double>> sums;
+};
+
+// Separable Gaussian of ImageMetrics::Filter() over rows of several channels fed in order, valid region only.
+template <int channels>
+class Ssim_gaussian
+{
+public:
+    void init(int width);
+
+    // Returns true once ssim_window rows are in, the filtered row is then in out.
+    bool add_row(const std::array<const double*, channels>& row, std::array<std::vector<double>, channels>& out);
+private:
+    int width;
+
+    // Next row.
+    int y;
+
+    // Horizontally filtered rows, the last ssim_window of them.
+    std::array<std::array<std::vector<double>, channels>, ssim_window> rows;
+};
+
+// Reference side of the SSIM, it's the same for every candidate.
+struct Ssim_reference
+{
+    int width;
+    int height;
+
+    // Subsampled reference and its Gaussian mean and variance.
+    int factor;
+    int sub_width;
+    int sub_height;
+    std::vector<double> image;
+    std::vector<double> mu;
+    std::vector<double> sigma_sq;
+};
+
+// Data are 8 bit rows of width, scaled to [0, 1].
+void create_ssim_reference(Ssim_reference& reference, const uint8_t* data, int width, int height);
+
+// SSIM of one image against the reference, fed one full resolution row at a time.
+// A tile of the image sums only rows [map_begin, map_end) of the SSIM map,
+// its rows have to start at first_row() and end at end_row(), the halo of the window and the boxes included.
+class Streaming_ssim
+{
+public:
+    void begin(const Ssim_reference& reference);
+    void begin(const Ssim_reference& reference, int map_begin, int map_end);
+    void add_row(const float* row);
+
+    // Rows of the subsampled image, for images resampled to it directly.
+    void add_subsampled_row(const float* row);
+
+    // Rows fed to the tile, subsampled ones if set.
+    int first_row(bool subsampled) const;
+    int end_row(bool subsampled) const;
+
+    // Adds the sum of a tile, in a fixed order the result doesn't depend on how the tiles were scheduled.
+    void merge(const Streaming_ssim& tile);
+
+    // Valid after all rows were added.
+    double result() const;
+private:
+    void add_image_row();
+
+    const Ssim_reference* reference;
+    Ssim_subsampler subsampler;
+    Ssim_gaussian<3> gaussian;
+    std::vector<double> image;
+
+    // x, x^2 and x * reference of the current subsampled row.
+    std::array<std::vector<double>, 3> products;
+
+    std::array<std::vector<double>, 3> filtered;
+
+    // Next subsampled row.
+    int sub_row;
+
+    // Rows of the SSIM map of the tile and the next one.
+    int map_begin;
+    int map_end;
+    int map_row;
+
+    double sum;
+};
@@ -0,0 +1,215 @@
+#include "sweep.h"
+#include "optimizer.h"
+#include "global.h"
+#include "config.h"
+
+// Batches per thread in a window of Sweep::run() from a source.
+// The threads wait for the last batch of a window, a window this long keeps that short next to it.
+static constexpr int window_batches = 64;
+
+bool fits_sweep_batch(const Sweep_batch& batch, const Kernel_params& params)
+{
+    return batch.empty() || (static_cast<int>(batch.size()) < (config::cpu ? config::batch : 1) && batch.back().params.radius == params.radius);
+}
+
+void add_sweep_point(std::vector<Sweep_batch>& batches, const Kernel_params& params)
+{
+    if (batches.empty() || !fits_sweep_batch(batches.back(), params)) {
+        batches.emplace_back();
+    }
+    batches.back().push_back({ params, 0.0, 0.0 });
+}
+
+void Sweep::init(const uint8_t* scaled_image_data)
+{
+    scale = static_cast<float>(g_dst_width) / static_cast<float>(g_src_width);
+    engines.resize(config::threads);
+    busy_seconds.assign(config::threads, 0.0);
+    wall_seconds = 0.0;
+    steals = 0;
+    auto init_engine = [&](Sweep_engine& engine) {
+        if (config::cpu) {
+            Cpu_engine& cpu_engine = engine.cpu_engine;
+            cpu_engine.init();
+            cpu_engine.create_image(scaled_image_data);
+            cpu_engine.scale = scale;
+            cpu_engine.half_intermediate = config::half;
+            cpu_engine.sparse_epsilon = config::sparse_eps;
+            cpu_engine.box_reduce = config::box_reduce;
+            cpu_engine.ssim_box = config::ssim_box;
+            cpu_engine.tile_threads = config::tile_threads;
+            cpu_engine.screen_rank = config::screen_rank;
+            if (config::optimizer == OPTIMIZER_LBFGSB) {
+                engine.gradient.init(scaled_image_data);
+            }
+        }
+        else {
+            engine.engine.init();
+            engine.engine.create_image(scaled_image_data);
+            engine.engine.scale = scale;
+        }
+    };
+
+    // Engines are independent, so they're created in parallel too.
+    std::vector<std::thread> threads;
+    for (auto& engine : engines) {
+        threads.emplace_back(init_engine, std::ref(engine));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void Sweep::run(std::vector<Sweep_batch>& batches, const std::function<void(const Sweep_batch&)>& done)
+{
+    if (engines.size() == 1) {
+        for (auto& batch : batches) {
+            evaluate(engines[0], batch);
+            done(batch);
+        }
+        return;
+    }
+
+    // Largest batches first, dealt round robin, so every thread starts with about the same load.
+    std::vector<double> costs(batches.size());
+    for (size_t i = 0; i < batches.size(); ++i) {
+        costs[i] = estimate_cost(batches[i]);
+    }
+    std::vector<size_t> order(batches.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return costs[a] > costs[b]; });
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<size_t> batches;
+    };
+    std::vector<Queue> queues(engines.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        queues[i % queues.size()].batches.push_back(order[i]);
+    }
+
+    // Nothing is added during the run, so a thread is done once every deque is empty.
+    std::atomic<int> run_steals = 0;
+    auto take = [&](size_t thread, size_t& batch) {
+        {
+            Queue& queue = queues[thread];
+            std::lock_guard lock(queue.mutex);
+            if (!queue.batches.empty()) {
+                batch = queue.batches.front();
+                queue.batches.pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); ++i) {
+            Queue& queue = queues[(thread + i) % queues.size()];
+            std::lock_guard lock(queue.mutex);
+            if (!queue.batches.empty()) {
+                batch = queue.batches.back();
+                queue.batches.pop_back();
+                ++run_steals;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Finished batches wait in a reorder buffer until all before them are passed on, so the output keeps the grid order.
+    std::vector<char> finished(batches.size());
+    std::mutex mutex;
+    std::condition_variable finished_changed;
+    auto work = [&](size_t thread) {
+        size_t i;
+        while (take(thread, i)) {
+            const auto start = std::chrono::steady_clock::now();
+            evaluate(engines[thread], batches[i]);
+            busy_seconds[thread] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            {
+                std::lock_guard lock(mutex);
+                finished[i] = true;
+            }
+            finished_changed.notify_one();
+        }
+    };
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < engines.size(); ++i) {
+        threads.emplace_back(work, i);
+    }
+    for (size_t i = 0; i < batches.size(); ++i) {
+        std::unique_lock lock(mutex);
+        finished_changed.wait(lock, [&]() { return finished[i]; });
+        lock.unlock();
+        done(batches[i]);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    wall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    steals += run_steals;
+}
+
+void Sweep::run(const Sweep_source& source, const std::function<void(const Sweep_batch&)>& done)
+{
+    const size_t window = static_cast<size_t>(window_batches) * engines.size();
+    std::vector<Sweep_batch> batches;
+    Sweep_batch batch;
+    while (source(batch)) {
+        batches.push_back(std::move(batch));
+        if (batches.size() == window) {
+            run(batches, done);
+            batches.clear();
+        }
+    }
+    if (!batches.empty()) {
+        run(batches, done);
+    }
+}
+
+// Relative cost, multiply-adds of the resampler per point and what SSIM costs next to them.
+double Sweep::estimate_cost(const Sweep_batch& batch) const
+{
+    const Kernel_params& k = batch[0].params;
+    const double bound = std::ceil(k.radius / std::min(scale, 1.0f));
+    const double dst_pixels = static_cast<double>(g_dst_width) * g_dst_height;
+    double cost;
+    if (config::filter == 0) {
+        cost = 2.0 * bound * (static_cast<double>(g_src_width) * g_dst_height + dst_pixels);
+    }
+    else {
+
+        // Cylindrical taps evaluate the kernel and a jinc window, unless the weights are precomputed per phase.
+        // Kaiser and plugins evaluate a Bessel function or unknown code on top.
+        double evaluation = 2.0;
+        if (k.index == KERNEL_FUNCTION_KAISER || k.index == KERNEL_FUNCTION_PLUGIN) {
+            evaluation = 3.0;
+        }
+        if (config::cpu && use_stencil_table(k, scale, g_src_width, g_src_height, g_dst_width, g_dst_height)) {
+            evaluation = 1.0;
+        }
+        cost = evaluation * 4.0 * bound * bound * dst_pixels;
+    }
+    return batch.size() * (cost + 32.0 * dst_pixels);
+}
+
+void Sweep::evaluate(Sweep_engine& engine, Sweep_batch& batch)
+{
+    if (config::cpu) {
+        const int count = static_cast<int>(batch.size());
+        std::array<Kernel_params, max_batch> params;
+        for (int i = 0; i < count; ++i) {
+            params[i] = batch[i].params;
+        }
+        engine.cpu_engine.resample_images(params.data(), count);
+        for (int i = 0; i < count; ++i) {
+            batch[i].result = engine.cpu_engine.compare(i);
+            batch[i].error = engine.cpu_engine.approximation_error(i);
+        }
+    }
+    else {
+        for (auto& point : batch) {
+            engine.engine.resample_image(point.params);
+            point.result = engine.engine.compare();
+            point.error = 0.0;
+        }
+    }
+}
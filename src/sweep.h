@@ -0,0 +1,69 @@
+#pragma once
+
+#include "common.h"
+#include "engine.h"
+#include "cpu_engine.h"
+#include "gradient.h"
+
+// A point of the parameter space and its SSIM.
+struct Sweep_point
+{
+    Kernel_params params;
+    double result;
+
+    // See Cpu_engine::approximation_error().
+    double error;
+};
+
+// Points resampled together, they share the radius.
+using Sweep_batch = std::vector<Sweep_point>;
+
+// Whether params can join batch, it's not full and has the same radius.
+// Points of the same radius share first pass source reads on the CPU, so they're batched.
+bool fits_sweep_batch(const Sweep_batch& batch, const Kernel_params& params);
+
+// Appends a point to the last batch, or starts a new one if it doesn't fit.
+void add_sweep_point(std::vector<Sweep_batch>& batches, const Kernel_params& params);
+
+// Replaces batch with the next batch of a sweep, returns false once there are none left.
+// Lets a grid be evaluated without holding all of its points.
+using Sweep_source = std::function<bool(Sweep_batch& batch)>;
+
+// Engine of one thread, with its own resample buffers and SSIM workspace.
+struct Sweep_engine
+{
+    Engine engine;
+    Cpu_engine cpu_engine;
+
+    // Only set up for --optimizer lbfgsb.
+    Ssim_gradient gradient;
+};
+
+// Evaluates batches of points on config::threads threads, each with its own engine, so nothing is shared but the images.
+// Batches are estimated how long they'll take and the largest go first, from a deque per thread,
+// a thread that runs out steals the smallest batches left in the others.
+class Sweep
+{
+public:
+    void init(const uint8_t* scaled_image_data);
+
+    // Evaluates all batches and passes each to done() on the calling thread, in the order of batches.
+    void run(std::vector<Sweep_batch>& batches, const std::function<void(const Sweep_batch&)>& done);
+
+    // Same for the batches of source, taken in windows of window_batches per thread, only the window in flight is held.
+    void run(const Sweep_source& source, const std::function<void(const Sweep_batch&)>& done);
+
+    // Evaluates batch on engine, on the calling thread.
+    void evaluate(Sweep_engine& engine, Sweep_batch& batch);
+
+    // Settings of the CPU engines can be changed between runs.
+    std::vector<Sweep_engine> engines;
+
+    // Totals of all runs on more than one thread, for the load imbalance report.
+    std::vector<double> busy_seconds;
+    double wall_seconds;
+    int steals;
+private:
+    double estimate_cost(const Sweep_batch& batch) const;
+    float scale;
+};